@@ -0,0 +1,114 @@
+/* ccmlink.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "ccmlink.h"
+#include <string.h>
+
+/* The CCM peripheral builds the 13-byte nonce from the configuration
+structure: the 39-bit packet counter, least significant byte first,
+with the direction bit as the top bit of its fifth byte, followed by
+the 8-byte IV.  We use a 32-bit counter, so the top 7 bits are zero,
+and the direction bit is always zero because every packet is a
+broadcast.  The IV holds the sender's address, the group and the
+protocol, then zeroes.  The CCM authenticates only some bits of the
+header byte H, not enough for a protocol number, but everything in the
+nonce is covered by the MIC. */
+
+/* ccm_setkey -- set the key and clear the rest of the configuration */
+void ccm_setkey(struct ccm_cnf *c, const unsigned char *key)
+{
+    memset(c, 0, sizeof(struct ccm_cnf));
+    memcpy(c->key, key, 16);
+}
+
+/* ccm_nonce -- set the nonce for a packet */
+void ccm_nonce(struct ccm_cnf *c, unsigned src, unsigned ctr,
+               unsigned group, unsigned proto)
+{
+    memset(c->pktctr, 0, 8);
+    for (int i = 0; i < 4; i++)
+        c->pktctr[i] = (ctr >> (8*i)) & 0xff;
+    c->direction = 0;
+
+    memset(c->iv, 0, 8);
+    c->iv[0] = src & 0xff;
+    c->iv[1] = (src >> 8) & 0xff;
+    c->iv[2] = group & 0xff;
+    c->iv[3] = proto & 0xff;
+}
+
+/* ccm_put_header -- store the clear part of a packet */
+void ccm_put_header(unsigned char *p, unsigned src, unsigned ctr)
+{
+    p[0] = src & 0xff;
+    p[1] = (src >> 8) & 0xff;
+    for (int i = 0; i < 4; i++)
+        p[2+i] = (ctr >> (8*i)) & 0xff;
+}
+
+/* ccm_get_header -- fetch the clear part of a packet */
+void ccm_get_header(const unsigned char *p, unsigned *src, unsigned *ctr)
+{
+    *src = p[0] | (p[1] << 8);
+    *ctr = 0;
+    for (int i = 0; i < 4; i++)
+        *ctr |= (unsigned) p[2+i] << (8*i);
+}
+
+/* A sender must never use a counter value twice with the same key,
+even after a reset, so it starts from a random value, and it stops
+sending rather than let the counter come back to where it started.
+At 1000 packets a second, that takes about seven weeks. */
+
+/* ccm_counter_init -- start counting from a given value */
+void ccm_counter_init(struct ccm_counter *k, unsigned start)
+{
+    k->next = k->start = start;
+    k->used = 0;
+}
+
+/* ccm_counter_next -- get a counter value, or return 0 if none are left */
+int ccm_counter_next(struct ccm_counter *k, unsigned *ctr)
+{
+    if (k->used) return 0;
+    *ctr = k->next++;
+    if (k->next == k->start) k->used = 1;
+    return 1;
+}
+
+/* Counters are compared by the sign of their difference, so that a
+counter that has wrapped around is still newer than one just before
+the wrap.  When the table is full, a new sender replaces the one that
+was heard from least recently. */
+
+/* ccm_replay_init -- forget all senders */
+void ccm_replay_init(struct ccm_replay *r)
+{
+    r->nsenders = 0;
+    r->clock = 0;
+}
+
+/* ccm_replay_check -- return 1 and record ctr if it is newer than the
+   last counter accepted from src, or 0 if the packet is a replay */
+int ccm_replay_check(struct ccm_replay *r, unsigned src, unsigned ctr)
+{
+    int i, oldest = 0;
+
+    for (i = 0; i < r->nsenders; i++) {
+        if (r->src[i] == src) break;
+        if (r->clock - r->age[i] > r->clock - r->age[oldest])
+            oldest = i;
+    }
+
+    if (i < r->nsenders) {
+        if ((int) (ctr - r->ctr[i]) <= 0) return 0;
+    } else if (r->nsenders < CCM_NSENDERS)
+        r->nsenders++;
+    else
+        i = oldest;
+
+    r->src[i] = src;
+    r->ctr[i] = ctr;
+    r->age[i] = r->clock++;
+    return 1;
+}
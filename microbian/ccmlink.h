@@ -0,0 +1,69 @@
+/* ccmlink.h */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Nonces and counters for encrypting radio packets with the CCM
+peripheral.  Like reliable.c, ccmlink.c depends on nothing in
+microbian, so that it can be tested on a host computer.
+
+An encrypted packet carries, after the usual three-byte prefix, the
+address of the sender and a counter in clear, then the header that the
+CCM expects, the encrypted data and a four-byte MIC:
+
+    src (2), ctr (4), H, L, RFU, data ..., MIC (4)
+
+Here H and RFU are zero, and L is the length of the data plus the MIC.
+The nonce is made from the counter, with the sender's address in the
+IV, so it is different for every packet as long as no sender uses the
+same counter twice with the same key.  The group and protocol bytes of
+the prefix are also in the IV, so that a packet whose prefix has been
+altered fails its MIC check.
+
+Each sender's counter goes up by one for every packet it sends, so a
+receiver remembers the last counter it accepted from each of the most
+recent CCM_NSENDERS senders, and drops any packet whose counter is not
+newer: that stops an attacker recording packets and playing them
+again.  Packets from a sender that has dropped out of the table are
+accepted once more, and a sender that is reset starts from a new random
+counter, so about half the time its packets will be dropped until the
+receivers set the key again. */
+
+#define CCM_VERSION 2           /* Version byte for encrypted packets */
+#define CCM_CLEAR 6             /* Bytes of src and ctr */
+#define CCM_MIC 4               /* Bytes of MIC */
+#define CCM_OVERHEAD (CCM_CLEAR + 3 + CCM_MIC) /* Extra bytes per packet */
+
+/* ccm_cnf -- data structure pointed to by CCM.CNFPTR */
+struct ccm_cnf {
+    unsigned char key[16];      /* AES key */
+    unsigned char pktctr[8];    /* Packet counter, 39 bits, LSB first */
+    unsigned char direction;    /* Direction bit */
+    unsigned char iv[8];        /* Initialisation vector */
+};
+
+/* ccm_counter -- counter for packets sent with one key */
+struct ccm_counter {
+    unsigned next;              /* Value for the next packet */
+    unsigned start;             /* First value used */
+    int used;                   /* Whether next has come round to start */
+};
+
+#define CCM_NSENDERS 8          /* Senders remembered for replay check */
+
+/* ccm_replay -- last counter accepted from each recent sender */
+struct ccm_replay {
+    int nsenders;               /* Number of entries in use */
+    unsigned src[CCM_NSENDERS]; /* Address of each sender */
+    unsigned ctr[CCM_NSENDERS]; /* Last counter accepted from it */
+    unsigned age[CCM_NSENDERS]; /* When it was last accepted */
+    unsigned clock;             /* Count of accepted packets */
+};
+
+void ccm_setkey(struct ccm_cnf *c, const unsigned char *key);
+void ccm_nonce(struct ccm_cnf *c, unsigned src, unsigned ctr,
+               unsigned group, unsigned proto);
+void ccm_put_header(unsigned char *p, unsigned src, unsigned ctr);
+void ccm_get_header(const unsigned char *p, unsigned *src, unsigned *ctr);
+void ccm_counter_init(struct ccm_counter *k, unsigned start);
+int ccm_counter_next(struct ccm_counter *k, unsigned *ctr);
+void ccm_replay_init(struct ccm_replay *r);
+int ccm_replay_check(struct ccm_replay *r, unsigned src, unsigned ctr);
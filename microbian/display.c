@@ -2,7 +2,7 @@
 /* Copyright (c) 2020 J. M. Spivey */
 
 /* A simple driver for the micro:bit LEDs with the same interface on
-V1 and V2. */
+V1 and V2.  There is no driver process: see display_init below. */
 
 #include "microbian.h"
 #include "hardware.h"
@@ -77,72 +77,270 @@ void image_set(int x, int y, image img)
     CLR_BIT(img[XPART(p)], YPART(p));
 }
 
-/* display_image is a shared variable between the client and the
-display driver task, but it is read-only in the task.  Partial updates
-don't really matter, because they will cause only a momentary glitch in
-the display when it is changing anyway. */
+/* image_shift -- move an image one column to the left, and fill the
+   right-hand column from the bits of col, with bit 0 at the top */
+void image_shift(image img, unsigned col)
+{
+    int x, y;
+    unsigned p, q;
 
-/* display_image -- shared variable for currently displayed image */
-static image display_image;
+    for (y = 0; y < 5; y++) {
+        for (x = 0; x < 4; x++) {
+            p = map_pixel(x+1, y); q = map_pixel(x, y);
+            if (GET_BIT(img[XPART(p)], YPART(p)))
+                SET_BIT(img[XPART(q)], YPART(q));
+            else
+                CLR_BIT(img[XPART(q)], YPART(q));
+        }
 
-/* display_task -- device driver for LED display */
-void display_task(int dummy)
-{
-    int n = 0;
+        p = map_pixel(4, y);
+        if (GET_BIT(col, y))
+            CLR_BIT(img[XPART(p)], YPART(p));
+        else
+            SET_BIT(img[XPART(p)], YPART(p));
+    }
+}
+
+/* The display is refreshed one row at a time by an interrupt handler
+for a hardware timer that is kept for the purpose, without involving
+the scheduler: the timer runs continuously, and each compare event
+both restarts its count (via a shortcut) and requests an interrupt.
+Because the row period is set by the hardware, the only jitter is the
+latency of the interrupt, and there are no messages or context
+switches at all once the display is running.  Driving the row and
+column pins through PPI and GPIOTE would remove even the interrupt,
+but there are too many pins changing at once for the eight GPIOTE
+channels, so the handler is left to do a handful of stores. */
 
 #ifdef UBIT_V1
-    GPIO.DIRSET = LED_MASK;
-    timer_pulse(5);             /* 5ms x 3 = 15ms updates */
+#define DISP_TIMER TIMER0
+#define DISP_IRQ TIMER0_IRQ
+#define disp_handler timer0_handler
+#define NWORDS 3                /* Words in an image */
+#define ROW_STEP 1              /* Words for each row */
+#define ROW_TIME 5000           /* 5ms x 3 = 15ms updates */
 #endif
-    
-#ifdef UBIT_V2
-    GPIO0.DIRSET = LED_MASK0;
-    GPIO1.DIRSET  = LED_MASK1;
-    
-    /* Set row pins to high-drive mode to increase brightness */
-    gpio_drive(ROW1, GPIO_DRIVE_S0H1);
-    gpio_drive(ROW2, GPIO_DRIVE_S0H1);
-    gpio_drive(ROW3, GPIO_DRIVE_S0H1);
-    gpio_drive(ROW4, GPIO_DRIVE_S0H1);
-    gpio_drive(ROW5, GPIO_DRIVE_S0H1);
 
-    timer_pulse(3);             /* 3ms * 5 = 15ms updates */
+#ifdef UBIT_V2
+#define DISP_TIMER TIMER4
+#define DISP_IRQ TIMER4_IRQ
+#define disp_handler timer4_handler
+#define NWORDS 10
+#define ROW_STEP 2
+#define ROW_TIME 3000           /* 3ms x 5 = 15ms updates */
 #endif
 
-    image_clear(display_image);
-    priority(P_HIGH);
+/* For greyscale, each pixel's brightness is a 4-bit number, and the
+image is split at show time into four bit-planes, each in the same
+form as an ordinary image.  Each row is shown in turn from each plane,
+with plane k lasting 2^k times as long as plane 0, so that the time an
+LED is lit is proportional to its brightness (binary code modulation).
+The interrupt handler reprograms the timer for the next step, but
+otherwise does no more work than before; a single-plane image keeps
+the old timing of one interrupt per row. */
+
+#define NPLANES 4               /* Bit-planes for DISPLAY_LEVELS */
+#define PLANE_TIME (ROW_TIME/15) /* Time for least significant plane */
 
-    while (1) {
-        /* Carefully change LED bits and leave other bits alone */
+/* There are two frame buffers: the interrupt handler shows the front
+one, and clients draw into the back one and then ask for a swap.  The
+handler makes the swap only at a frame boundary, before the top row is
+shown, so each frame is shown whole and there is no tearing.  While
+drawing, a client holds off the swap by clearing the swap flag; that
+is enough, because the handler cannot be interrupted by the client, so
+the back buffer cannot become the front one while it is being changed.
+If a client shows several images within one frame, the last one wins.
+The handler can also wake processes at each frame boundary, so that
+animations can be paced by the display itself.  Any number of processes
+can wait at once: there is a bit for each one, and process ids are less
+than 32. */
+
+/* frame -- a buffer for the display */
+struct frame {
+    image plane[NPLANES];       /* Bit-planes to show */
+    int nplanes;                /* Number in use: 1 or NPLANES */
+};
+
+static struct frame frame[2];
+
+/* front -- index of buffer that is being displayed */
+static volatile int front = 0;
+
+/* swap -- whether the back buffer is ready to show */
+static volatile int swap = 0;
+
+/* vsync_clients -- bitmap of processes to wake at the next frame boundary */
+static volatile unsigned vsync_clients = 0;
+
+/* row, plane -- the next row to show and the plane to show it from */
+static int row = 0, plane = 0;
+
+/* max_latency -- longest delay seen in responding to the timer */
+static unsigned max_latency = 0;
+
+/* disp_handler -- interrupt handler for the display timer */
+void disp_handler(void)
+{
+    struct frame *f;
+    unsigned *img, lat;
+
+    if (! DISP_TIMER.COMPARE[0]) return;
+    DISP_TIMER.COMPARE[0] = 0;
+
+    /* The count was cleared by the compare event, so it now shows how
+       long it took to get here. */
+    DISP_TIMER.CAPTURE[1] = 1;
+    lat = DISP_TIMER.CC[1];
+    if (lat > max_latency) max_latency = lat;
+
+    if (row == 0 && plane == 0) {
+        /* Frame boundary */
+        if (swap) {
+            front = 1 - front;
+            swap = 0;
+        }
+
+        if (vsync_clients != 0) {
+            unsigned w = vsync_clients;
+            vsync_clients = 0;
+            for (int pid = 0; w != 0; pid++, w >>= 1) {
+                if (w & 1) interrupt(pid);
+            }
+        }
+    }
+
+    f = &frame[front];
+    img = f->plane[plane];
+
+    /* Carefully change LED bits and leave other bits alone */
 #ifdef UBIT_V1
-        GPIO.OUTCLR = 0xfff0;
-        GPIO.OUTSET = display_image[n++];
-        if (n == 3) n = 0;
+    GPIO.OUTCLR = 0xfff0;
+    GPIO.OUTSET = img[row];
 #endif
 
 #ifdef UBIT_V2
-        /* To avoid ghosting, clear GPIO0 (which contains the row bits)
-           first and set it last. */
-        GPIO0.OUTCLR = LED_MASK0;
-        GPIO1.OUTCLR = LED_MASK1;
-        GPIO1.OUTSET = display_image[n+1];
-        GPIO0.OUTSET = display_image[n];
-        n += 2;
-        if (n == 10) n = 0;
+    /* To avoid ghosting, clear GPIO0 (which contains the row bits)
+       first and set it last. */
+    GPIO0.OUTCLR = LED_MASK0;
+    GPIO1.OUTCLR = LED_MASK1;
+    GPIO1.OUTSET = img[row+1];
+    GPIO0.OUTSET = img[row];
 #endif
 
-        receive(PING, NULL);
+    if (f->nplanes == 1)
+        DISP_TIMER.CC[0] = ROW_TIME;
+    else
+        DISP_TIMER.CC[0] = PLANE_TIME << plane;
+
+    if (++plane >= f->nplanes) {
+        plane = 0;
+        row += ROW_STEP;
+        if (row == NWORDS) row = 0;
     }
 }
 
-/* display_show -- set display from image */
+/* back_buffer -- hold off swapping and return the back buffer */
+static struct frame *back_buffer(void)
+{
+    swap = 0;
+    return &frame[1 - front];
+}
+
+/* display_show -- set display from image at the next frame */
 void display_show(const image img)
 {
-    memcpy(display_image, img, sizeof(image));
+    struct frame *f = back_buffer();
+    memcpy(f->plane[0], img, sizeof(image));
+    f->nplanes = 1;
+    swap = 1;
+}
+
+/* display_show_grey -- set display from an array of brightnesses */
+void display_show_grey(const byte px[25])
+{
+    /* Pixels are in rows from the top, with brightnesses from 0 to
+       DISPLAY_LEVELS-1; larger values are treated as full brightness */
+    struct frame *f = back_buffer();
+    int x, y, k;
+
+    for (k = 0; k < NPLANES; k++)
+        image_clear(f->plane[k]);
+
+    for (y = 0; y < 5; y++) {
+        for (x = 0; x < 5; x++) {
+            unsigned p = map_pixel(x, y);
+            int v = px[5*y+x];
+            if (v >= DISPLAY_LEVELS) v = DISPLAY_LEVELS-1;
+            for (k = 0; k < NPLANES; k++) {
+                if (v & BIT(k))
+                    CLR_BIT(f->plane[k][XPART(p)], YPART(p));
+            }
+        }
+    }
+
+    f->nplanes = NPLANES;
+    swap = 1;
+}
+
+/* display_notify -- ask for an interrupt message at the next frame
+   boundary, without waiting for it */
+void display_notify(void)
+{
+    /* The caller should not be a driver process that expects
+       interrupts of its own. */
+    unsigned prev = get_primask();
+    intr_disable();
+    SET_BIT(vsync_clients, getpid());
+    set_primask(prev);
+}
+
+/* display_vsync -- wait for the next frame boundary */
+void display_vsync(void)
+{
+    /* Any image shown before the call is on display when it returns */
+    display_notify();
+    receive(INTERRUPT, NULL);
+}
+
+/* display_latency -- return and reset the worst-case refresh latency
+   in microseconds */
+unsigned display_latency(void)
+{
+    unsigned lat = max_latency;
+    max_latency = 0;
+    return lat;
 }
 
-/* display_init -- start display driver task */
+/* display_init -- set up the pins and start the refresh timer */
 void display_init(void)
 {
-    start("Display", display_task, 0, STACK);
+#ifdef UBIT_V1
+    GPIO.DIRSET = LED_MASK;
+#endif
+    
+#ifdef UBIT_V2
+    GPIO0.DIRSET = LED_MASK0;
+    GPIO1.DIRSET  = LED_MASK1;
+    
+    /* Set row pins to high-drive mode to increase brightness */
+    gpio_drive(ROW1, GPIO_DRIVE_S0H1);
+    gpio_drive(ROW2, GPIO_DRIVE_S0H1);
+    gpio_drive(ROW3, GPIO_DRIVE_S0H1);
+    gpio_drive(ROW4, GPIO_DRIVE_S0H1);
+    gpio_drive(ROW5, GPIO_DRIVE_S0H1);
+#endif
+
+    image_clear(frame[0].plane[0]);
+    frame[0].nplanes = 1;
+
+    DISP_TIMER.STOP = 1;
+    DISP_TIMER.MODE = TIMER_MODE_Timer;
+    DISP_TIMER.BITMODE = TIMER_BITMODE_16Bit;
+    DISP_TIMER.PRESCALER = 4;   /* 1MHz = 16MHz / 2^4 */
+    DISP_TIMER.CLEAR = 1;
+    DISP_TIMER.CC[0] = ROW_TIME;
+    DISP_TIMER.SHORTS = BIT(TIMER_COMPARE0_CLEAR);
+    DISP_TIMER.INTENSET = BIT(TIMER_INT_COMPARE0);
+    DISP_TIMER.START = 1;
+    enable_irq(DISP_IRQ);
 }
@@ -100,6 +100,8 @@ argument to be a macro that expands the a 'position, width' pair. */
 #define RTC0_IRQ   11
 #define TEMP_IRQ   12
 #define RNG_IRQ    13
+#define ECB_IRQ    14
+#define CCM_AAR_IRQ 15
 #define RTC1_IRQ   17
 #define TIMER3_IRQ 26
 #define TIMER4_IRQ 27
@@ -372,8 +374,8 @@ _DEVICE _ppi {
     } CH[20], 0x510);
     _REGISTER(unsigned CHGRP[6], 0x800);
     _REGISTER(struct {
-        unsigned volatile *FORK;
-    }, 0x910);
+        unsigned volatile *TEP;
+    } FORK[20], 0x910);
 };
 
 #define PPI (* (volatile _DEVICE _ppi *) 0x4001f000)
@@ -401,6 +403,8 @@ _DEVICE _radio {
     _REGISTER(unsigned DEVMISS, 0x118);
     _REGISTER(unsigned RSSIEND, 0x11c);
     _REGISTER(unsigned BCMATCH, 0x128);
+    _REGISTER(unsigned TXREADY, 0x154);
+    _REGISTER(unsigned RXREADY, 0x158);
 /* Registers */
     _REGISTER(unsigned SHORTS, 0x200);
     _REGISTER(unsigned INTENSET, 0x304);
@@ -414,10 +418,16 @@ _DEVICE _radio {
     _REGISTER(unsigned TXPOWER, 0x50c);
     _REGISTER(unsigned MODE, 0x510);
 #define   RADIO_MODE_NRF_1Mbit 0
+#define   RADIO_MODE_NRF_2Mbit 1
+#define   RADIO_MODE_BLE_1Mbit 3
+#define   RADIO_MODE_BLE_2Mbit 4
     _REGISTER(unsigned PCNF0, 0x514);
 #define   RADIO_PCNF0_LFLEN 0, 3
 #define   RADIO_PCNF0_S0LEN 8, 1
 #define   RADIO_PCNF0_S1LEN 16, 4
+#define   RADIO_PCNF0_PLEN 24, 2
+#define     RADIO_PLEN_8bit 0
+#define     RADIO_PLEN_16bit 1
     _REGISTER(unsigned PCNF1, 0x518);
 #define   RADIO_PCNF1_MAXLEN 0, 8
 #define   RADIO_PCNF1_STATLEN 8, 8
@@ -439,20 +449,44 @@ _DEVICE _radio {
     _REGISTER(unsigned TIFS, 0x544);
     _REGISTER(unsigned RSSISAMPLE, 0x548);
     _REGISTER(unsigned STATE, 0x550);
+#define   RADIO_STATE_Disabled 0
+#define   RADIO_STATE_RxRu 1
+#define   RADIO_STATE_RxIdle 2
+#define   RADIO_STATE_Rx 3
+#define   RADIO_STATE_RxDisable 4
+#define   RADIO_STATE_TxRu 9
+#define   RADIO_STATE_TxIdle 10
+#define   RADIO_STATE_Tx 11
+#define   RADIO_STATE_TxDisable 12
     _REGISTER(unsigned DATAWHITEIV, 0x554);
     _REGISTER(unsigned BCC, 0x560);
     _REGISTER(unsigned DAB[8], 0x600);
     _REGISTER(unsigned DAP[8], 0x620);
     _REGISTER(unsigned DACNF, 0x640);
+    _REGISTER(unsigned MODECNF0, 0x650);
+#define   RADIO_MODECNF0_RU 0
+#define   RADIO_MODECNF0_DTX 8, 2
     _REGISTER(unsigned OVERRIDE[5], 0x724);
     _REGISTER(unsigned POWER, 0xffc);
 };
 
 /* Interrupts */
 #define RADIO_INT_READY 0
+#define RADIO_INT_ADDRESS 1
+#define RADIO_INT_PAYLOAD 2
 #define RADIO_INT_END 3
 #define RADIO_INT_DISABLED 4
 
+/* Shortcuts */
+#define RADIO_READY_START 0
+#define RADIO_END_DISABLE 1
+#define RADIO_DISABLED_TXEN 2
+#define RADIO_DISABLED_RXEN 3
+#define RADIO_ADDRESS_RSSISTART 4
+#define RADIO_END_START 5
+#define RADIO_ADDRESS_BCSTART 6
+#define RADIO_DISABLED_RSSISTOP 8
+
 #define RADIO (* (volatile _DEVICE _radio *) 0x40001000)
 
 
@@ -509,6 +543,52 @@ _DEVICE _timer {
 extern volatile _DEVICE _timer * const TIMER[5];
 
 
+/* AES CCM mode encryption, as used by Bluetooth LE */
+_DEVICE _ccm {
+/* Tasks */
+    _REGISTER(unsigned KSGEN, 0x000);
+    _REGISTER(unsigned CRYPT, 0x004);
+    _REGISTER(unsigned STOP, 0x008);
+/* Events */
+    _REGISTER(unsigned ENDKSGEN, 0x100);
+    _REGISTER(unsigned ENDCRYPT, 0x104);
+    _REGISTER(unsigned ERROR, 0x108);
+/* Registers */
+    _REGISTER(unsigned SHORTS, 0x200);
+    _REGISTER(unsigned INTENSET, 0x304);
+    _REGISTER(unsigned INTENCLR, 0x308);
+    _REGISTER(unsigned MICSTATUS, 0x400);
+    _REGISTER(unsigned ENABLE, 0x500);
+#define   CCM_ENABLE_Disabled 0
+#define   CCM_ENABLE_Enabled 2
+    _REGISTER(unsigned MODE, 0x504);
+#define   CCM_MODE_MODE 0, 1
+#define     CCM_MODE_Encryption 0
+#define     CCM_MODE_Decryption 1
+#define   CCM_MODE_DATARATE 16, 2
+#define     CCM_DATARATE_1Mbit 0
+#define     CCM_DATARATE_2Mbit 1
+#define   CCM_MODE_LENGTH 24, 1
+#define     CCM_LENGTH_Default 0
+#define     CCM_LENGTH_Extended 1
+    _REGISTER(void *CNFPTR, 0x508);
+    _REGISTER(void *INPTR, 0x50c);
+    _REGISTER(void *OUTPTR, 0x510);
+    _REGISTER(void *SCRATCHPTR, 0x514);
+    _REGISTER(unsigned MAXPACKETSIZE, 0x518);
+};
+
+/* Interrupts */
+#define CCM_INT_ENDKSGEN 0
+#define CCM_INT_ENDCRYPT 1
+#define CCM_INT_ERROR 2
+
+/* Shortcuts */
+#define CCM_ENDKSGEN_CRYPT 0
+
+#define CCM (* (volatile _DEVICE _ccm *) 0x4000f000)
+
+
 /* Random Number Generator */
 _DEVICE _rng {
 /* Tasks */
@@ -606,6 +686,74 @@ _DEVICE _i2c {
 extern volatile _DEVICE _i2c * const I2C[2];
 
 
+/* TWIM -- I2C master with EasyDMA, sharing addresses with I2C */
+_DEVICE _twim {
+/* Tasks */
+    _REGISTER(unsigned STARTRX, 0x000);
+    _REGISTER(unsigned STARTTX, 0x008);
+    _REGISTER(unsigned STOP, 0x014);
+    _REGISTER(unsigned SUSPEND, 0x01c);
+    _REGISTER(unsigned RESUME, 0x020);
+/* Events */
+    _REGISTER(unsigned STOPPED, 0x104);
+    _REGISTER(unsigned ERROR, 0x124);
+    _REGISTER(unsigned SUSPENDED, 0x148);
+    _REGISTER(unsigned RXSTARTED, 0x14c);
+    _REGISTER(unsigned TXSTARTED, 0x150);
+    _REGISTER(unsigned LASTRX, 0x15c);
+    _REGISTER(unsigned LASTTX, 0x160);
+/* Registers */
+    _REGISTER(unsigned SHORTS, 0x200);
+    _REGISTER(unsigned INTEN, 0x300);
+    _REGISTER(unsigned INTENSET, 0x304);
+    _REGISTER(unsigned INTENCLR, 0x308);
+    _REGISTER(unsigned ERRORSRC, 0x4c4);
+#define   TWIM_ERRORSRC_OVERRUN 0
+#define   TWIM_ERRORSRC_ANACK 1
+#define   TWIM_ERRORSRC_DNACK 2
+#define   TWIM_ERRORSRC_All 0x7
+    _REGISTER(unsigned ENABLE, 0x500) ;
+#define   TWIM_ENABLE_Disabled 0
+#define   TWIM_ENABLE_Enabled 6
+    _REGISTER(unsigned PSELSCL, 0x508);
+    _REGISTER(unsigned PSELSDA, 0x50c);
+    _REGISTER(unsigned FREQUENCY, 0x524);
+#define   TWIM_FREQUENCY_100kHz 0x01980000
+#define   TWIM_FREQUENCY_250kHz 0x04000000
+#define   TWIM_FREQUENCY_400kHz 0x06400000
+    _REGISTER(void *RXD_PTR, 0x534);
+    _REGISTER(unsigned RXD_MAXCNT, 0x538);
+    _REGISTER(unsigned RXD_AMOUNT, 0x53c);
+    _REGISTER(unsigned RXD_LIST, 0x540);
+    _REGISTER(void *TXD_PTR, 0x544);
+    _REGISTER(unsigned TXD_MAXCNT, 0x548);
+    _REGISTER(unsigned TXD_AMOUNT, 0x54c);
+    _REGISTER(unsigned TXD_LIST, 0x550);
+    _REGISTER(unsigned ADDRESS, 0x588);
+    _REGISTER(unsigned POWER, 0xffc);
+};
+
+/* Interrupts */
+#define TWIM_INT_STOPPED 1
+#define TWIM_INT_ERROR 9
+#define TWIM_INT_SUSPENDED 18
+#define TWIM_INT_RXSTARTED 19
+#define TWIM_INT_TXSTARTED 20
+#define TWIM_INT_LASTRX 23
+#define TWIM_INT_LASTTX 24
+/* Shortcuts */
+#define TWIM_LASTTX_STARTRX 7
+#define TWIM_LASTTX_SUSPEND 8
+#define TWIM_LASTTX_STOP 9
+#define TWIM_LASTRX_STARTTX 10
+#define TWIM_LASTRX_STOP 12
+
+#define TWIM0 (* (volatile _DEVICE _twim *) 0x40003000)
+#define TWIM1 (* (volatile _DEVICE _twim *) 0x40004000)
+
+extern volatile _DEVICE _twim * const TWIM[2];
+
+
 /* UART */
 _DEVICE _uart {
 /* Tasks */
@@ -29,152 +29,261 @@ static struct {
 #endif
 };
 
-/* i2c_wait -- wait for an expected interrupt event and detect error */
-static int i2c_wait(int chan, unsigned volatile *event)
+/* The driver uses the TWIM interface, which moves data to and from
+memory by EasyDMA, so that the driver takes one interrupt for a whole
+transaction, rather than one or two per byte.  A write-then-read
+transaction uses the shortcuts LASTTX_STARTRX to send a repeated start
+when the command has been sent and LASTRX_STOP to finish, and a write
+uses LASTTX_STOP.  EasyDMA can transmit only from one contiguous
+buffer in RAM, so the command and data for a write are first copied
+into txbuf.  If they will not fit, the command is sent with the
+shortcut LASTTX_SUSPEND, and the data follow after a RESUME.
+
+Each transaction is described by an i2c_req, and clients submit
+lists of them, linked by the next field.  The driver keeps a queue of
+lists and never waits for the hardware: it starts a transaction, then
+goes back to receiving messages, so that other clients can add to the
+queue while the bus is busy.  When a transaction finishes, the driver
+starts the next one before telling the client, so the bus is kept
+busy.  A list submitted with i2c_submit is acknowledged with a
+FINISHED message when all its transactions are complete, and one
+submitted with i2c_batch gets a REPLY.  As with the timer, the client must be waiting
+for the message, or the driver will be held up. */
+
+#define I2C_SETFREQ 16          /* Change bus frequency */
+#define I2C_SUBMIT 17           /* Start list of transactions */
+#define I2C_BATCH 18            /* Same, replying when done */
+
+#define NTX 32                  /* Size of transmit buffer */
+
+/* Driver states */
+#define I2C_IDLE 0              /* Bus is idle */
+#define I2C_BUSY 1              /* Waiting for STOPPED */
+#define I2C_SUSPEND 2           /* Waiting for SUSPENDED in long write */
+
+/* i2c_state -- driver state for each channel */
+static struct i2c_state {
+    int state;                  /* I2C_IDLE, I2C_BUSY or I2C_SUSPEND */
+    int failed;                 /* Whether current transaction failed */
+    i2c_req *cur;               /* Current transaction */
+    i2c_req *head, *tail;       /* Queue of lists; head is active */
+    unsigned freq;              /* Frequency to use, or 0 if no change */
+    byte txbuf[NTX];            /* Buffer for writes */
+} i2c_state[N_I2C];
+
+/* i2c_start -- start a transaction on the bus */
+static void i2c_start(int chan, i2c_req *r)
 {
-    int irq = i2c_pins[chan].irq;
+    struct i2c_state *s = &i2c_state[chan];
 
-    receive(INTERRUPT, NULL);
+    if (s->freq != 0) {
+        TWIM[chan]->ENABLE = TWIM_ENABLE_Disabled;
+        TWIM[chan]->FREQUENCY = s->freq;
+        TWIM[chan]->ENABLE = TWIM_ENABLE_Enabled;
+        s->freq = 0;
+    }
 
-    if (I2C[chan]->ERROR) {
-        I2C[chan]->ERROR = 0; 
-        clear_pending(irq);
-        enable_irq(irq);
-        return ERR;
-    }      
+    s->cur = r;
+    s->state = I2C_BUSY;
+    TWIM[chan]->ADDRESS = r->addr;
+
+    if (r->kind == READ) {
+        TWIM[chan]->RXD_PTR = r->buf2;
+        TWIM[chan]->RXD_MAXCNT = r->n2;
+
+        if (r->n1 == 0) {
+            TWIM[chan]->SHORTS = BIT(TWIM_LASTRX_STOP);
+            TWIM[chan]->STARTRX = 1;
+        } else {
+            /* Copy the command, so it need not be in RAM */
+            byte *buf1 = r->buf1;
+            if (r->n1 <= NTX) {
+                for (int i = 0; i < r->n1; i++) s->txbuf[i] = r->buf1[i];
+                buf1 = s->txbuf;
+            }
 
-    assert(*event);
-    *event = 0;                                 
-    clear_pending(irq);
-    enable_irq(irq);
-    return OK;
+            TWIM[chan]->TXD_PTR = buf1;
+            TWIM[chan]->TXD_MAXCNT = r->n1;
+            TWIM[chan]->SHORTS =
+                BIT(TWIM_LASTTX_STARTRX) | BIT(TWIM_LASTRX_STOP);
+            TWIM[chan]->STARTTX = 1;
+        }
+    } else if (r->n1 + r->n2 <= NTX) {
+        /* Gather the bytes into txbuf */
+        byte *p = s->txbuf;
+        for (int i = 0; i < r->n1; i++) *p++ = r->buf1[i];
+        for (int i = 0; i < r->n2; i++) *p++ = r->buf2[i];
+
+        TWIM[chan]->TXD_PTR = s->txbuf;
+        TWIM[chan]->TXD_MAXCNT = r->n1 + r->n2;
+        TWIM[chan]->SHORTS = BIT(TWIM_LASTTX_STOP);
+        TWIM[chan]->STARTTX = 1;
+    } else {
+        /* Too big: send buf1 then suspend while we set up buf2 */
+        TWIM[chan]->TXD_PTR = r->buf1;
+        TWIM[chan]->TXD_MAXCNT = r->n1;
+        TWIM[chan]->SHORTS = BIT(TWIM_LASTTX_SUSPEND);
+        TWIM[chan]->INTENSET = BIT(TWIM_INT_SUSPENDED);
+        TWIM[chan]->STARTTX = 1;
+        s->state = I2C_SUSPEND;
+    }
 }
 
-/* i2c_do_write -- send one or more bytes */
-static int i2c_do_write(int chan, char *buf, int n)
+/* i2c_next -- start the next transaction from the queue, if any */
+static void i2c_next(int chan)
 {
-    int status = OK;
+    struct i2c_state *s = &i2c_state[chan];
 
-    /* The I2C hardware makes zero-length writes impossible, because
-       there is no event generated when the address has been sent. */
+    if (s->head == NULL)
+        s->state = I2C_IDLE;
+    else
+        i2c_start(chan, s->head);
+}
 
-    for (int i = 0; i < n; i++) {
-        I2C[chan]->TXD = buf[i];
-        status = i2c_wait(chan, &I2C[chan]->TXDSENT);
-        if (status != OK) return status;
+/* i2c_enqueue -- add a list of transactions to the queue */
+static void i2c_enqueue(int chan, i2c_req *list, int client, int type)
+{
+    struct i2c_state *s = &i2c_state[chan];
+
+    list->client = client;
+    list->reply = type;
+    list->link = NULL;
+
+    if (s->head == NULL)
+        s->head = list;
+    else
+        s->tail->link = list;
+    s->tail = list;
+
+    if (s->state == I2C_IDLE) i2c_next(chan);
+}
+
+/* i2c_complete -- finish current transaction and start the next */
+static void i2c_complete(int chan, int status)
+{
+    struct i2c_state *s = &i2c_state[chan];
+    i2c_req *r = s->cur, *list = s->head;
+    message m;
+
+    r->status = status;
+    r->error = 0;
+    if (status != OK) {
+        r->error = TWIM[chan]->ERRORSRC;
+        TWIM[chan]->ERRORSRC = TWIM_ERRORSRC_All;
     }
 
-    return OK;
+    if (r->next != NULL) {
+        /* More to do in this list */
+        i2c_start(chan, r->next);
+        return;
+    }
+
+    /* The list is finished: start the next one, then tell the client */
+    s->head = list->link;
+    i2c_next(chan);
+
+    m.int1 = OK;
+    for (r = list; r != NULL; r = r->next) {
+        if (r->status != OK) m.int1 = r->status;
+    }
+    m.ptr2 = list;
+    send(list->client, list->reply, &m);
 }
 
-/* i2c_stop -- signal stop condition */
-static void i2c_stop(int chan)
+/* i2c_interrupt -- handle an interrupt */
+static void i2c_interrupt(int chan)
 {
-    I2C[chan]->STOP = 1;
-    i2c_wait(chan, &I2C[chan]->STOPPED);
+    struct i2c_state *s = &i2c_state[chan];
+    i2c_req *r = s->cur;
+    int irq = i2c_pins[chan].irq;
+
+    if (TWIM[chan]->ERROR) {
+        /* After an error, the hardware still needs to be stopped */
+        TWIM[chan]->ERROR = 0;
+        s->failed = 1;
+        if (s->state == I2C_SUSPEND) {
+            TWIM[chan]->INTENCLR = BIT(TWIM_INT_SUSPENDED);
+            TWIM[chan]->SUSPENDED = 0;
+            s->state = I2C_BUSY;
+        }
+        TWIM[chan]->STOP = 1;
+    }
+
+    if (s->state == I2C_SUSPEND && TWIM[chan]->SUSPENDED) {
+        /* First part of a long write is done: send the rest */
+        TWIM[chan]->SUSPENDED = 0;
+        TWIM[chan]->INTENCLR = BIT(TWIM_INT_SUSPENDED);
+        TWIM[chan]->TXD_PTR = r->buf2;
+        TWIM[chan]->TXD_MAXCNT = r->n2;
+        TWIM[chan]->SHORTS = BIT(TWIM_LASTTX_STOP);
+        TWIM[chan]->STARTTX = 1;
+        TWIM[chan]->RESUME = 1;
+        s->state = I2C_BUSY;
+    }
+
+    if (s->state == I2C_BUSY && TWIM[chan]->STOPPED) {
+        TWIM[chan]->STOPPED = 0;
+        TWIM[chan]->SHORTS = 0;
+        i2c_complete(chan, (s->failed ? ERR : OK));
+        s->failed = 0;
+    }
+
+    clear_pending(irq);
+    enable_irq(irq);
+}
+
+/* i2c_freq -- map frequency in kHz to register setting */
+static unsigned i2c_freq(int khz)
+{
+    switch (khz) {
+    case 100:
+        return TWIM_FREQUENCY_100kHz;
+    case 250:
+        return TWIM_FREQUENCY_250kHz;
+    case 400:
+        return TWIM_FREQUENCY_400kHz;
+    default:
+        panic("I2C frequency %d kHz is not supported", khz);
+        return 0;
+    }
 }
 
 /* i2c_task -- driver process for I2C hardware */
 static void i2c_task(int chan)
 {
     message m;
-    int client, addr, n1, n2, status, error = 0;
-    char *buf1, *buf2;
 
-    /* Configure I2C hardware */
-    I2C[chan]->PSELSCL = i2c_pins[chan].scl;
-    I2C[chan]->PSELSDA = i2c_pins[chan].sda;
-    I2C[chan]->FREQUENCY = I2C_FREQUENCY_100kHz;
-    I2C[chan]->ENABLE = I2C_ENABLE_Enabled;
+    /* Configure TWIM hardware */
+    TWIM[chan]->PSELSCL = i2c_pins[chan].scl;
+    TWIM[chan]->PSELSDA = i2c_pins[chan].sda;
+    TWIM[chan]->FREQUENCY = TWIM_FREQUENCY_100kHz;
+    TWIM[chan]->ENABLE = TWIM_ENABLE_Enabled;
 
     /* Enable interrupts */
-    I2C[chan]->INTEN = BIT(I2C_INT_RXDREADY) | BIT(I2C_INT_TXDSENT)
-        | BIT(I2C_INT_STOPPED) | BIT(I2C_INT_ERROR);
+    TWIM[chan]->INTEN = BIT(TWIM_INT_STOPPED) | BIT(TWIM_INT_ERROR);
     connect(i2c_pins[chan].irq);
     enable_irq(i2c_pins[chan].irq);
 
     while (1) {
         receive(ANY, &m);
-        client = m.sender;
-        addr = m.byte1;        /* Address [0..127] without R/W flag */
-        n1 = m.byte2;          /* Number of bytes in command */
-        n2 = m.byte3;          /* Number of bytes to transfer (R/W) */
-        buf1 = m.ptr2;        /* Buffer for command */
-        buf2 = m.ptr3;        /* Buffer for transfer */
 
         switch (m.type) {
-        case READ:
-            I2C[chan]->ADDRESS = addr;
-            status = OK;
-             
-            if (n1 > 0) {
-                /* Write followed by read, with repeated start */
-                I2C[chan]->STARTTX = 1;
-                status = i2c_do_write(chan, buf1, n1);
-            }
+        case INTERRUPT:
+            i2c_interrupt(chan);
+            break;
 
-            /* The hardware reference manual is wrong in several ways,
-               but the following code (based on timing diagrams in the
-               reference manual) works reliably. */
-
-            if (status == OK) {
-                for (int i = 0; i < n2; i++) {
-                    /* On all but the last byte, use SUSPEND to send
-                       an ACK after receiving the byte.  Use STOP to
-                       send a NACK at the end. */
-                    if (i < n2-1)
-                        I2C[chan]->SHORTS = BIT(I2C_BB_SUSPEND);
-                    else
-                        I2C[chan]->SHORTS = BIT(I2C_BB_STOP);
-        
-                    /* Start the first byte with STARTTX, and the rest
-                       with RESUME following the SUSPEND. */
-                    if (i == 0)
-                        I2C[chan]->STARTRX = 1;
-                    else
-                        I2C[chan]->RESUME = 1;
-        
-                    status = i2c_wait(chan, &I2C[chan]->RXDREADY);
-                    if (status != OK) break;
-                    buf2[i] = I2C[chan]->RXD;
-                }
-            }
-            
-            if (status == OK)
-                i2c_wait(chan, &I2C[chan]->STOPPED);
-
-            if (status != OK) {
-                i2c_stop(chan);
-                error = I2C[chan]->ERRORSRC;
-                I2C[chan]->ERRORSRC = I2C_ERRORSRC_All;
-            }
+        case I2C_SUBMIT:
+            i2c_enqueue(chan, m.ptr2, m.sender, FINISHED);
+            break;
 
-            I2C[chan]->SHORTS = 0;
-            m.int1 = status;
-            m.int2 = error;
-            send(client, REPLY, &m);
+        case I2C_BATCH:
+            i2c_enqueue(chan, m.ptr2, m.sender, REPLY);
             break;
 
-        case WRITE:
-            I2C[chan]->ADDRESS = addr;
-            status = OK;
-
-            /* A single write transaction */
-            I2C[chan]->STARTTX = 1;
-            if (n1 > 0)
-                status = i2c_do_write(chan, buf1, n1);
-            if (status == OK && n2 > 0)
-                status = i2c_do_write(chan, buf2, n2);
-            i2c_stop(chan);
-
-            if (status != OK) {
-                error = I2C[chan]->ERRORSRC;
-                I2C[chan]->ERRORSRC = I2C_ERRORSRC_All;
-            }
-               
-            m.int1 = status;
-            m.int2 = error;
-            send(client, REPLY, &m);
+        case I2C_SETFREQ:
+            /* Takes effect before the next transaction */
+            i2c_state[chan].freq = i2c_freq(m.int1);
+            send(m.sender, REPLY, NULL);
             break;
 
         default:
@@ -190,18 +299,69 @@ void i2c_init(int chan)
         I2C_TASK[chan] = start("I2C", i2c_task, chan, 256);
 }
 
+/* i2c_submit -- start a list of transactions without waiting */
+void i2c_submit(int chan, i2c_req *list)
+{
+    /* The driver sends a FINISHED message with ptr2 = list when the
+       whole list is complete.  The buffers must stay valid until
+       then, and buffers for reading must be in RAM for EasyDMA. */
+    message m;
+    m.ptr2 = list;
+    send(I2C_TASK[chan], I2C_SUBMIT, &m);
+}
+
+/* i2c_batch -- carry out a list of transactions; return OK or ERR */
+int i2c_batch(int chan, i2c_req *list)
+{
+    message m;
+    m.ptr2 = list;
+    sendrec(I2C_TASK[chan], I2C_BATCH, &m);
+    return m.int1;
+}
+
+/* i2c_read_regs -- read n one-byte registers in a single request */
+int i2c_read_regs(int chan, int addr, const byte *regs, byte *vals, int n)
+{
+    i2c_req r[n];
+
+    for (int i = 0; i < n; i++) {
+        r[i].kind = READ;
+        r[i].addr = addr;
+        r[i].n1 = 1;
+        r[i].n2 = 1;
+        r[i].buf1 = (byte *) &regs[i];
+        r[i].buf2 = &vals[i];
+        r[i].next = (i < n-1 ? &r[i+1] : NULL);
+    }
+
+    return i2c_batch(chan, r);
+}
+
 /* i2c_xfer -- i2c transaction with command write then data read or write */
 int i2c_xfer(int chan, int kind, int addr,
              byte *buf1, int n1, byte *buf2, int n2) {
+    i2c_req r;
+
+    /* EasyDMA counts in the TWIM are 16 bits */
+    if (n1 < 0 || n1 > 0xffff || n2 < 0 || n2 > 0xffff)
+        panic("Bad I2C transfer size %d+%d", n1, n2);
+
+    r.kind = kind;
+    r.addr = addr;
+    r.n1 = n1;
+    r.n2 = n2;
+    r.buf1 = buf1;
+    r.buf2 = buf2;
+    r.next = NULL;
+    return i2c_batch(chan, &r);
+}
+
+/* i2c_frequency -- set bus speed to 100, 250 or 400 kHz */
+void i2c_frequency(int chan, int khz)
+{
     message m;
-    m.byte1 = addr;
-    m.byte2 = n1;
-    m.byte3 = n2;
-    m.ptr2 = buf1;
-    m.ptr3 = buf2;
-    send(I2C_TASK[chan], kind, &m);
-    receive(REPLY, &m);
-    return m.int1;
+    m.int1 = khz;
+    sendrec(I2C_TASK[chan], I2C_SETFREQ, &m);
 }
 
 /* i2c_probe -- try to access an I2C device */
@@ -211,6 +371,68 @@ int i2c_probe(int chan, int addr)
     return i2c_xfer(chan, WRITE, addr, &buf, 1, NULL, 0);
 }
      
+/* Drivers for I2C devices often read a control register, change some
+bits and write it back, even though the value is one they wrote
+themselves.  A client can declare such registers as cacheable with
+i2c_cache; the library then keeps a copy of the last value written or
+read, and i2c_read_reg returns it without using the bus.  Writes go
+through to the device as well as updating the copy.  Registers whose
+contents are changed by the device itself, such as data or status
+registers, must not be declared cacheable.  The cache is shared by
+all processes, and the client is expected not to access the same
+device from more than one process at once. */
+
+#define NCACHE 16
+
+/* i2c_cache_tab -- table of cacheable registers */
+static struct {
+    byte used;                  /* Whether this entry is in use */
+    byte valid;                 /* Whether val is known */
+    byte chan, addr, reg;       /* Identity of the register */
+    byte val;                   /* Its value */
+} i2c_cache_tab[NCACHE];
+
+/* find_cache -- find cache entry for a register, or -1 */
+static int find_cache(int chan, int addr, int reg)
+{
+    for (int i = 0; i < NCACHE; i++) {
+        if (i2c_cache_tab[i].used && i2c_cache_tab[i].chan == chan
+            && i2c_cache_tab[i].addr == addr && i2c_cache_tab[i].reg == reg)
+            return i;
+    }
+
+    return -1;
+}
+
+/* i2c_cache -- declare a register as cacheable */
+void i2c_cache(int chan, int addr, int reg)
+{
+    if (find_cache(chan, addr, reg) >= 0) return;
+
+    for (int i = 0; i < NCACHE; i++) {
+        if (! i2c_cache_tab[i].used) {
+            i2c_cache_tab[i].used = 1;
+            i2c_cache_tab[i].valid = 0;
+            i2c_cache_tab[i].chan = chan;
+            i2c_cache_tab[i].addr = addr;
+            i2c_cache_tab[i].reg = reg;
+            return;
+        }
+    }
+
+    panic("Too many cached I2C registers");
+}
+
+/* invalidate -- forget cached values for registers of a device */
+static void invalidate(int chan, int addr)
+{
+    for (int i = 0; i < NCACHE; i++) {
+        if (i2c_cache_tab[i].used && i2c_cache_tab[i].chan == chan
+            && i2c_cache_tab[i].addr == addr)
+            i2c_cache_tab[i].valid = 0;
+    }
+}
+
 /* i2c_read_bytes -- send command and read multi-byte result */
 void i2c_read_bytes(int chan, int addr, int cmd, byte *buf2, int n2)
 {
@@ -222,8 +444,19 @@ void i2c_read_bytes(int chan, int addr, int cmd, byte *buf2, int n2)
 /* i2c_read_reg -- send command and read one byte */
 int i2c_read_reg(int chan, int addr, int cmd)
 {
+    int k = find_cache(chan, addr, cmd);
     byte buf;
+
+    if (k >= 0 && i2c_cache_tab[k].valid)
+        return i2c_cache_tab[k].val;
+
     i2c_read_bytes(chan, addr, cmd, &buf, 1);
+
+    if (k >= 0) {
+        i2c_cache_tab[k].val = buf;
+        i2c_cache_tab[k].valid = 1;
+    }
+
     return buf;
 }
 
@@ -231,13 +464,40 @@ int i2c_read_reg(int chan, int addr, int cmd)
 void i2c_write_bytes(int chan, int addr, int cmd, byte *buf2, int n2)
 {
     byte buf1 = cmd;
-    int status = i2c_xfer(chan, WRITE, addr, &buf1, 1, buf2, n2);
+    int status;
+
+    /* Devices differ in how they map multi-byte writes onto registers,
+       so we forget everything we knew about the device. */
+    invalidate(chan, addr);
+
+    status = i2c_xfer(chan, WRITE, addr, &buf1, 1, buf2, n2);
     assert(status == OK);
 }
 
 /* i2c_write_reg -- send command and write data */
 void i2c_write_reg(int chan, int addr, int cmd, int val)
 {
-    byte buf = val;
-    i2c_write_bytes(chan, addr, cmd, &buf, 1);
+    int k = find_cache(chan, addr, cmd);
+    byte buf[2];
+    int status;
+
+    buf[0] = cmd; buf[1] = val;
+    status = i2c_xfer(chan, WRITE, addr, buf, 2, NULL, 0);
+    assert(status == OK);
+
+    if (k >= 0) {
+        i2c_cache_tab[k].val = val;
+        i2c_cache_tab[k].valid = 1;
+    }
+}
+
+/* i2c_update_reg -- change the bits of a register given by mask */
+void i2c_update_reg(int chan, int addr, int cmd, int mask, int bits)
+{
+    /* For a cacheable register, this costs at most one write */
+    int old = i2c_read_reg(chan, addr, cmd);
+    int val = (old & ~mask) | (bits & mask);
+
+    if (val != old)
+        i2c_write_reg(chan, addr, cmd, val);
 }
@@ -4,33 +4,100 @@
 #include "lib.h"
 #include "hardware.h"
 
-#define NMAX 16                 /* Max digits in a printed number */
+#define NMAX 32                 /* Max chars in a converted number */
 
-/* utoa -- convert unsigned to decimal or hex */
-static char *utoa(unsigned x, unsigned base, char *nbuf)
+/* Conversions avoid the divide instruction, which takes up to 12
+cycles on the Cortex-M4.  Division of a 32-bit unsigned x by 10 is
+done by multiplying by the fixed-point reciprocal 0xcccccccd/2^35,
+which gives the exact quotient for every x.  For 64-bit numbers, we
+use the shift-and-add method from Hacker's Delight, which gives a
+quotient that is at most one too small, and then correct it. */
+
+/* div10 -- divide 32-bit unsigned by 10 */
+static inline unsigned div10(unsigned x)
+{
+    return ((unsigned long long) x * 0xcccccccd) >> 35;
+}
+
+/* ldiv10 -- divide 64-bit unsigned by 10 */
+static unsigned long long ldiv10(unsigned long long x)
+{
+    unsigned long long q = (x >> 1) + (x >> 2);
+    q += q >> 4; q += q >> 8; q += q >> 16; q += q >> 32;
+    q >>= 3;
+    if (x - q*10 >= 10) q++;
+    return q;
+}
+
+/* utoa -- convert unsigned to decimal, working backwards from p */
+static char *utoa(unsigned x, char *p)
+{
+    do {
+        unsigned q = div10(x);
+        *--p = x - q*10 + '0';
+        x = q;
+    } while (x != 0);
+
+    return p;
+}
+
+/* ultoa -- convert 64-bit unsigned to decimal */
+static char *ultoa(unsigned long long x, char *p)
+{
+    /* Use 64-bit arithmetic only until the number fits in 32 bits */
+    while ((x >> 32) != 0) {
+        unsigned long long q = ldiv10(x);
+        *--p = x - q*10 + '0';
+        x = q;
+    }
+
+    return utoa(x, p);
+}
+
+/* xtoa -- convert 64-bit unsigned to hex */
+static char *xtoa(unsigned long long x, char *p)
 {
-    char *p = &nbuf[NMAX];
     const char *hex = "0123456789abcdef";
 
-    *--p = '\0';
     do {
-        *--p = hex[x % base];
-        x = x / base;
+        *--p = hex[x & 0xf];
+        x >>= 4;
     } while (x != 0);
-     
+
     return p;
 }
 
-/* itoa -- convert signed integer to decimal */
-static char *itoa(int v, char *nbuf)
+/* fixtoa -- convert t/s to decimal with n places, like fmt_fixed in
+   x02-instrs; s must not be zero.  The places are reduced if
+   (t % s) * 10^n would not fit in 32 bits; that also keeps n <= 9, so
+   the result fits in nbuf. */
+static char *fixtoa(unsigned t, unsigned s, int n, char *p)
 {
-    if (v >= 0)
-        return utoa(v, 10, nbuf);
-    else {
-        char *p = utoa(-v, 10, nbuf);
-        *--p = '-';
-        return p;
+    unsigned long long m = s;
+    unsigned v, r;
+    int k = 0;
+
+    while (k < n && m * 10 <= 0x100000000ULL) {
+        m *= 10; k++;
     }
+    n = k;
+
+    /* Scale and round half up to n places */
+    v = t % s;
+    for (int d = 0; d < n; d++) v *= 10;
+    r = v % s; v = v / s;
+    if (r >= s - r) v++;
+
+    /* Fractional part */
+    for (int d = 0; d < n; d++) {
+        unsigned q = div10(v);
+        *--p = v - q*10 + '0';
+        v = q;
+    }
+
+    /* Integer part, including any carry from rounding up */
+    if (n > 0) *--p = '.';
+    return utoa(v + t/s, p);
 }
 
 /* atoi -- convert decimal string to integer */
@@ -86,52 +153,140 @@ The three public functions share a common skeleton _do_print that
 takes as parameters a "putc-function" and a pointer q that is passed
 to the function with each character.  Different putc-functions and
 different interpretations of the pointer q are needed for different
-applications. */
+applications.
+
+Each conversion has the form %[-0][width][.prec][l]c, where c is one
+of these letters:
+
+    c   a character
+    d   a signed decimal integer
+    u   an unsigned decimal integer
+    x   an unsigned hex integer, prefixed with 0x unless it is zero
+    s   a string
+    q   a fixed-point number t/s to prec places (default 3), taking
+        two unsigned arguments t and s; if s is zero, it prints ?
+
+The l modifier with d, u or x means the argument is a 64-bit long long
+(because long is only 32 bits on the ARM).  The result is padded to
+the width with spaces on the left, with zeroes after any sign or
+prefix if the 0 flag is given, or with spaces on the right if the -
+flag is given. */
 
 
 /* do_string -- output or buffer each character of a string */
-static void do_string(void (*putc)(void *, char), void *q, char *str)
+static void do_string(void (*putc)(void *, char), void *q, const char *str)
 {
-    for (char *p = str; *p != '\0'; p++)
+    for (const char *p = str; *p != '\0'; p++)
         putc(q, *p);
 }
 
+/* length -- length of a string */
+static int length(const char *str)
+{
+    const char *p = str;
+    while (*p != '\0') p++;
+    return p - str;
+}
+
+/* do_pad -- output n copies of a character */
+static void do_pad(void (*putc)(void *, char), void *q, char ch, int n)
+{
+    while (n-- > 0) putc(q, ch);
+}
+
 /* _do_print -- the guts of printf */
 void _do_print(void (*putc)(void *, char), void *q,
                const char *fmt, va_list va) {
-    int x;
-    char nbuf[NMAX];
+    /* Numbers are converted backwards from the end of nbuf */
+    char nbuf[NMAX], *end = &nbuf[NMAX-1];
+    *end = '\0';
 
     for (const char *p = fmt; *p != 0; p++) {
-        if (*p == '%' && *(p+1) != '\0') {
-            switch (*++p) {
-            case 'c':
-                putc(q, va_arg(va, int));
-                break;
-            case 'd':
-                do_string(putc, q, itoa(va_arg(va, int), nbuf));
-                break;
-            case 's':
-                do_string(putc, q, va_arg(va, char *));
-                break;
-            case 'u':
-                do_string(putc, q, utoa(va_arg(va, unsigned), 10, nbuf));
-                break;
-            case 'x':
-                x = va_arg(va, unsigned);
-                if (x == 0)
-                    putc(q, '0');
-                else {
-                    putc(q, '0'); putc(q, 'x');
-                    do_string(putc, q, utoa(x, 16, nbuf));
-                }
-                break;
-            default:
-                putc(q, *p);
-                break;
+        if (*p != '%' || *(p+1) == '\0') {
+            putc(q, *p);
+            continue;
+        }
+
+        int left = 0, zero = 0, wide = 0, width = 0, prec = -1;
+        const char *str, *prefix = "";
+        unsigned long long x;
+        int len;
+
+        /* Flags, width, precision and size */
+        for (p++; *p == '-' || *p == '0'; p++) {
+            if (*p == '-') left = 1; else zero = 1;
+        }
+        while (*p >= '0' && *p <= '9')
+            width = 10 * width + (*p++ - '0');
+        if (*p == '.') {
+            prec = 0;
+            for (p++; *p >= '0' && *p <= '9'; p++)
+                prec = 10 * prec + (*p - '0');
+        }
+        while (*p == 'l') {
+            wide = 1; p++;
+        }
+        if (*p == '\0') break;
+
+        switch (*p) {
+        case 'c':
+            nbuf[0] = va_arg(va, int); nbuf[1] = '\0';
+            str = nbuf;
+            break;
+        case 'd':
+            if (wide) {
+                long long v = va_arg(va, long long);
+                x = (v < 0 ? -(unsigned long long) v : v);
+                if (v < 0) prefix = "-";
+            } else {
+                int v = va_arg(va, int);
+                x = (v < 0 ? -(unsigned) v : v);
+                if (v < 0) prefix = "-";
             }
-        } else {
+            str = (wide ? ultoa(x, end) : utoa(x, end));
+            break;
+        case 'u':
+            x = (wide ? va_arg(va, unsigned long long)
+                 : va_arg(va, unsigned));
+            str = (wide ? ultoa(x, end) : utoa(x, end));
+            break;
+        case 'x':
+            x = (wide ? va_arg(va, unsigned long long)
+                 : va_arg(va, unsigned));
+            if (x != 0) prefix = "0x";
+            str = xtoa(x, end);
+            break;
+        case 'q': {
+            unsigned t = va_arg(va, unsigned);
+            unsigned s = va_arg(va, unsigned);
+            if (s == 0)
+                str = "?";
+            else
+                str = fixtoa(t, s, (prec < 0 ? 3 : prec), end);
+            break;
+        }
+        case 's':
+            str = va_arg(va, char *);
+            break;
+        default:
             putc(q, *p);
+            continue;
+        }
+
+        len = length(prefix) + length(str);
+
+        if (left) {
+            do_string(putc, q, prefix);
+            do_string(putc, q, str);
+            do_pad(putc, q, ' ', width - len);
+        } else if (zero) {
+            do_string(putc, q, prefix);
+            do_pad(putc, q, '0', width - len);
+            do_string(putc, q, str);
+        } else {
+            do_pad(putc, q, ' ', width - len);
+            do_string(putc, q, prefix);
+            do_string(putc, q, str);
         }
     }
 }     
@@ -169,6 +324,42 @@ int sprintf(char *buf, const char *fmt, ...)
     return (p - buf);
 }
 
+/* struct bounded -- state for snprintf */
+struct bounded {
+    char *p;                    /* Next free place */
+    char *limit;                /* Last place, reserved for '\0' */
+    int count;                  /* Characters produced so far */
+};
+
+/* f_boundc -- putc-function that stores characters up to a limit */
+static void f_boundc(void *q, char c)
+{
+    struct bounded *b = q;
+    if (b->p < b->limit) *b->p++ = c;
+    b->count++;
+}
+
+/* snprintf -- print to a character array of size n */
+int snprintf(char *buf, int n, const char *fmt, ...)
+{
+    struct bounded b;
+    va_list va;
+
+    if (n <= 0) {
+        /* Count the characters without storing them */
+        b.p = b.limit = NULL;
+    } else {
+        b.p = buf; b.limit = &buf[n-1];
+    }
+    b.count = 0;
+
+    va_start(va, fmt);
+    _do_print(f_boundc, &b, fmt, va);
+    va_end(va);
+    if (n > 0) *b.p = '\0';
+    return b.count;
+}
+
 /* printf's internal buffer complicates the behaviour of the 'chaos'
 example: don't be tempted to make the buffer bigger, or all chaos will
 be removed!  Clients not running under micro:bian see no benefit from
@@ -8,12 +8,17 @@
 /* do_print -- the device-independent guts of printf */
 void do_print(void (*putch)(char), const char *fmt, va_list va);
 
-/* printf -- print using putchar */
+/* printf -- print using putchar.  The conversions are listed in lib.c;
+   %q with a scale of zero prints ? rather than dividing by zero */
 void printf(const char *fmt, ...);
 
 /* sprintf -- print to string buffer.  Note danger of overflow! */
 int sprintf(char *buf, const char *fmt, ...);
 
+/* snprintf -- print to string buffer of size n, truncating if needed;
+   return length of the untruncated output */
+int snprintf(char *buf, int n, const char *fmt, ...);
+
 /* atoi -- convert decimal string to int */
 int atoi(const char *p);
 
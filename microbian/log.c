@@ -0,0 +1,174 @@
+/* log.c */
+/* Copyright (c) 2020 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+
+/* Formatting a message with printf costs thousands of cycles for the
+divisions in utoa and the calls of the putc-function for each
+character, then more time to send the characters at 9600 baud.  The
+LOG macro in microbian.h defers all that to the host: the format
+string goes into a section .logfmt that the linker script marks as
+INFO, so it is kept in the ELF file but never loaded into flash, and
+the address of the string -- its offset in the section -- serves as an
+ID.  At runtime, LOG just copies the ID and the argument words into a
+ring buffer; that costs a few tens of cycles, and can be done from an
+interrupt handler.
+
+A log process drains the ring periodically and sends each record over
+the serial port as a binary frame:
+
+    LOG_SYNC, header word, nargs argument words, checksum byte
+
+with all words little-endian.  The header contains the ID and the
+number of arguments, and the checksum is the sum of the bytes that
+follow the sync byte, modulo 256.  The host program x34-output/logdecode
+reads the format strings from the ELF file and prints the records
+as text, passing through any other characters that appear on the serial
+line, so printf and LOG can be used together.
+
+Space in the ring is reserved with a compare-and-swap on log_head, so
+processes and interrupt handlers can log concurrently without
+disabling interrupts.  A record is made visible to the reader by
+writing its header last with the LOG_VALID bit set; the reader stops at
+the first record whose header is not yet valid.  If the ring is full,
+the record is dropped and counted, and the count is sent to the host
+as a record with ID LOG_DROPPED. */
+
+static int LOG_TASK;
+
+#define LOG_SIZE 256            /* Words in the ring: a power of two */
+#define LOG_MASK (LOG_SIZE-1)
+#define LOG_PERIOD 50           /* Interval between drains (ms) */
+
+static volatile unsigned log_ring[LOG_SIZE];
+static volatile unsigned log_head = 0; /* Next word to reserve */
+static volatile unsigned log_tail = 0; /* Next word to drain */
+static unsigned log_dropped = 0; /* Records dropped since last report */
+
+/* log_event -- append a record to the ring */
+void log_event(unsigned id, int nargs, const unsigned *args)
+{
+    unsigned h, need = nargs+1;
+
+    /* LOG checks this at compile time, but others may call us */
+    if (nargs < 0 || nargs > LOG_MAXARGS)
+        panic("Bad argument count %d for log_event", nargs);
+
+    /* Reserve space for the header and arguments */
+    h = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    do {
+        if (h + need - log_tail > LOG_SIZE) {
+            __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (! __atomic_compare_exchange_n(&log_head, &h, h + need, 1,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED));
+
+    for (int i = 0; i < nargs; i++)
+        log_ring[(h+1+i) & LOG_MASK] = args[i];
+
+    /* Publish the record */
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    log_ring[h & LOG_MASK] = LOG_VALID | (nargs << LOG_NSHIFT) | id;
+}
+
+
+/* The log process builds frames in a buffer and sends them with
+serial_write, which sends straight from the buffer. */
+
+#define FRAME (1 + 4*(LOG_MAXARGS+1) + 1) /* Max bytes in a frame */
+#define NOUT 128
+
+static char outbuf[NOUT];
+static int nout = 0;
+
+/* put_frame -- format a record as a frame in outbuf */
+static void put_frame(unsigned hdr, const unsigned *args, int nargs)
+{
+    byte sum = 0;
+
+    outbuf[nout++] = LOG_SYNC;
+
+    for (int i = -1; i < nargs; i++) {
+        unsigned w = (i < 0 ? hdr : args[i]);
+        for (int j = 0; j < 4; j++) {
+            byte b = w & 0xff;
+            outbuf[nout++] = b;
+            sum += b;
+            w >>= 8;
+        }
+    }
+
+    outbuf[nout++] = sum;
+}
+
+/* drain -- send all complete records in the ring */
+static void drain(void)
+{
+    unsigned t = log_tail, hdr, dropped;
+    unsigned args[LOG_MAXARGS];
+    int nargs;
+
+    while (t != log_head) {
+        hdr = log_ring[t & LOG_MASK];
+        if ((hdr & LOG_VALID) == 0) break; /* Not yet published */
+        nargs = (hdr >> LOG_NSHIFT) & LOG_NMASK;
+        assert(nargs <= LOG_MAXARGS);
+
+        /* Copy out the record and free the space before sending, so
+           writers are not held up.  Every word is cleared, so that a
+           stale argument cannot be mistaken for a valid header. */
+        log_ring[t & LOG_MASK] = 0;
+        for (int i = 0; i < nargs; i++) {
+            args[i] = log_ring[(t+1+i) & LOG_MASK];
+            log_ring[(t+1+i) & LOG_MASK] = 0;
+        }
+        t += nargs+1;
+        log_tail = t;
+
+        if (nout + FRAME > NOUT) {
+            serial_write(outbuf, nout);
+            nout = 0;
+        }
+        put_frame(hdr, args, nargs);
+    }
+
+    dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        if (nout + FRAME > NOUT) {
+            serial_write(outbuf, nout);
+            nout = 0;
+        }
+        put_frame(LOG_VALID | (1 << LOG_NSHIFT) | LOG_DROPPED,
+                  &dropped, 1);
+    }
+
+    if (nout > 0) {
+        serial_write(outbuf, nout);
+        nout = 0;
+    }
+}
+
+/* log_task -- process that drains the log */
+static void log_task(int arg)
+{
+    message m;
+
+    /* Run above normal processes, so that a busy client cannot stop
+       the log being drained; we spend most of the time blocked. */
+    priority(P_HIGH);
+    timer_pulse(LOG_PERIOD);
+
+    while (1) {
+        receive(PING, &m);
+        drain();
+    }
+}
+
+/* log_init -- start the log process */
+void log_init(void)
+{
+    LOG_TASK = start("Log", log_task, 0, 256);
+}
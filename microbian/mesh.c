@@ -0,0 +1,390 @@
+/* mesh.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "mesh.h"
+#include <string.h>
+
+/* Every data packet carries its source address and a sequence number
+chosen by the source, and each node remembers the (source, seq) pairs
+it has seen recently, so that it handles each packet only once.
+
+A packet sent to MESH_BROADCAST is flooded: every node that receives
+it for the first time delivers it, and broadcasts it again if its hop
+limit (TTL) allows.  If all neighbours repeated a packet at once, the
+copies would collide, so each node waits a random time of up to
+MESH_BACKOFF usec first; and if it hears MESH_SUPPRESS copies from
+other nodes while waiting, its own copy would add nothing, so it is
+cancelled.
+
+Packets for a single node follow routes found by a distance-vector
+protocol with destination sequence numbers, as in DSDV.  Each node
+broadcasts a beacon every MESH_BEACON usec carrying a sequence number
+that it increases each time, and listing the destinations it can
+reach, with the number of hops and the latest sequence number it has
+heard from each one.  A node that hears a beacon learns a route to the
+sender with one hop, and to each listed destination with one hop more.
+A route with a newer sequence number always replaces an older one,
+and among routes with the same sequence number the shortest wins.
+Because news spreads outwards from each destination, a node never
+takes a route from a neighbour that depends on the node itself, so
+routing loops cannot form and persist as they can with plain distance
+vectors.  A route is forgotten after MESH_EXPIRE usec without news.
+A unicast packet names the neighbour that should forward it, and other
+nodes ignore it.
+
+Data packets look like this:
+
+    'M', ttl, src (2), seq (2), dest (2), hop (2), hops, data ...
+
+where hop is the neighbour chosen to forward a unicast packet, or
+MESH_BROADCAST for a flooded one, and hops counts the hops so far.
+Beacons look like this:
+
+    'B', src (2), seq (2), count, then for each route:
+        dest (2), seq (2), metric
+
+with multi-byte fields little-endian. */
+
+#define MESH_DATA 'M'
+#define MESH_BEACONPKT 'B'
+#define MESH_BHEADER 6          /* Bytes of header on a beacon, as in mesh.h */
+
+/* put16, get16 -- little-endian fields of a packet */
+static void put16(unsigned char *p, unsigned x)
+{
+    p[0] = x & 0xff; p[1] = (x >> 8) & 0xff;
+}
+
+static unsigned get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/* next_random -- xorshift pseudo-random number generator */
+static unsigned next_random(mesh_node *m)
+{
+    unsigned x = m->random;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    m->random = x;
+    return x;
+}
+
+/* mesh_init -- initialise a node */
+void mesh_init(mesh_node *m, int id, unsigned seed,
+               void (*output)(mesh_node *m, const unsigned char *pkt, int n),
+               void (*deliver)(mesh_node *m, int src, int hops,
+                               const unsigned char *data, int n))
+{
+    memset(m, 0, sizeof(mesh_node));
+    m->id = id;
+    m->random = (seed == 0 ? 1 : seed);
+    m->output = output;
+    m->deliver = deliver;
+
+    /* An empty cache entry must not match a real packet */
+    for (int i = 0; i < MESH_NCACHE; i++)
+        m->cache[i].src = MESH_BROADCAST;
+}
+
+
+/* DUPLICATE CACHE */
+
+/* seen -- test if a packet has been seen before */
+static int seen(mesh_node *m, int src, int seq)
+{
+    for (int i = 0; i < MESH_NCACHE; i++) {
+        if (m->cache[i].src == src && m->cache[i].seq == seq)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* remember -- add a packet to the cache, replacing the oldest */
+static void remember(mesh_node *m, int src, int seq)
+{
+    m->cache[m->c_next].src = src;
+    m->cache[m->c_next].seq = seq;
+    m->c_next = (m->c_next+1) % MESH_NCACHE;
+}
+
+
+/* ROUTE TABLE */
+
+/* lookup -- find the route to a destination, or return -1 */
+static int lookup(mesh_node *m, int dest)
+{
+    for (int i = 0; i < MESH_NROUTES; i++) {
+        if (m->route[i].metric > 0 && m->route[i].dest == dest)
+            return i;
+    }
+
+    return -1;
+}
+
+/* mesh_route -- return the next hop to a destination, or -1 */
+int mesh_route(mesh_node *m, int dest)
+{
+    int r = lookup(m, dest);
+    return (r < 0 ? -1 : m->route[r].next);
+}
+
+/* newer -- compare 16-bit sequence numbers that may wrap around */
+#define newer(a, b) ((short) ((a) - (b)) > 0)
+
+/* update -- take note of a route heard from a neighbour */
+static void update(mesh_node *m, int dest, int seq, int next, int metric,
+                   unsigned now)
+{
+    int r = lookup(m, dest);
+
+    if (metric >= MESH_INFINITY) return;
+
+    if (r >= 0) {
+        /* Keep the old route unless the new one is fresher or shorter */
+        if (! newer(seq, m->route[r].seq)
+            && ! (seq == m->route[r].seq && metric < m->route[r].metric))
+            return;
+    } else {
+        /* Use an empty slot, or else replace the longest route if it
+           is longer than the new one */
+        r = 0;
+        for (int i = 0; i < MESH_NROUTES; i++) {
+            if (m->route[i].metric == 0) {
+                r = i;
+                break;
+            }
+            if (m->route[i].metric > m->route[r].metric) r = i;
+        }
+
+        if (m->route[r].metric > 0 && m->route[r].metric <= metric)
+            return;
+    }
+
+    m->route[r].dest = dest;
+    m->route[r].seq = seq;
+    m->route[r].next = next;
+    m->route[r].metric = metric;
+    m->route[r].updated = now;
+}
+
+/* send_beacon -- broadcast the route table */
+static void send_beacon(mesh_node *m)
+{
+    unsigned char pkt[MESH_BHEADER + 5*MESH_NROUTES];
+    int k = 0;
+
+    for (int i = 0; i < MESH_NROUTES; i++) {
+        if (m->route[i].metric == 0) continue;
+        unsigned char *e = &pkt[MESH_BHEADER + 5*k++];
+        put16(&e[0], m->route[i].dest);
+        put16(&e[2], m->route[i].seq);
+        e[4] = m->route[i].metric;
+    }
+
+    pkt[0] = MESH_BEACONPKT;
+    put16(&pkt[1], m->id);
+    put16(&pkt[3], m->beacon_seq++);
+    pkt[5] = k;
+    (*m->output)(m, pkt, MESH_BHEADER + 5*k);
+}
+
+/* beacon_input -- learn routes from a neighbour's beacon */
+static void beacon_input(mesh_node *m, const unsigned char *pkt, int n,
+                         unsigned now)
+{
+    int from = get16(&pkt[1]), seq = get16(&pkt[3]), count = pkt[5];
+
+    if (n < MESH_BHEADER + 5*count || from == m->id) return;
+
+    update(m, from, seq, from, 1, now);
+
+    for (int i = 0; i < count; i++) {
+        const unsigned char *e = &pkt[MESH_BHEADER + 5*i];
+        int dest = get16(&e[0]);
+        if (dest == m->id) continue;
+        update(m, dest, get16(&e[2]), from, e[4] + 1, now);
+    }
+}
+
+
+/* DATA PACKETS */
+
+/* schedule -- queue a flooded packet for rebroadcast after a backoff */
+static void schedule(mesh_node *m, const unsigned char *pkt, int n,
+                     unsigned now)
+{
+    for (int i = 0; i < MESH_NPENDING; i++) {
+        if (! m->pending[i].busy) {
+            m->pending[i].busy = 1;
+            m->pending[i].due = now + next_random(m) % MESH_BACKOFF;
+            m->pending[i].heard = 0;
+            m->pending[i].n = n;
+            memcpy(m->pending[i].pkt, pkt, n);
+            return;
+        }
+    }
+
+    m->stats.dropped++;
+}
+
+/* overheard -- note a copy of a packet that is waiting to be repeated */
+static void overheard(mesh_node *m, int src, int seq)
+{
+    for (int i = 0; i < MESH_NPENDING; i++) {
+        if (m->pending[i].busy
+            && get16(&m->pending[i].pkt[2]) == src
+            && get16(&m->pending[i].pkt[4]) == seq
+            && ++m->pending[i].heard >= MESH_SUPPRESS) {
+            m->pending[i].busy = 0;
+            m->stats.suppressed++;
+        }
+    }
+}
+
+/* mesh_send -- send data to a node or flood it; return 1 if sent */
+int mesh_send(mesh_node *m, int dest, const void *buf, int n)
+{
+    unsigned char pkt[MESH_HEADER+MESH_MAXDATA];
+    int hop = MESH_BROADCAST;
+
+    if (n > MESH_MAXDATA) n = MESH_MAXDATA;
+
+    if (dest != MESH_BROADCAST) {
+        int r = lookup(m, dest);
+        if (r < 0) {
+            m->stats.dropped++;
+            return 0;
+        }
+        hop = m->route[r].next;
+    }
+
+    pkt[0] = MESH_DATA;
+    pkt[1] = MESH_TTL;
+    put16(&pkt[2], m->id);
+    put16(&pkt[4], m->seq);
+    put16(&pkt[6], dest);
+    put16(&pkt[8], hop);
+    pkt[10] = 0;
+    memcpy(&pkt[MESH_HEADER], buf, n);
+
+    remember(m, m->id, m->seq);
+    m->seq++;
+    m->stats.sent++;
+    (*m->output)(m, pkt, MESH_HEADER+n);
+    return 1;
+}
+
+/* data_input -- deliver or forward a data packet */
+static void data_input(mesh_node *m, unsigned char *pkt, int n,
+                       unsigned now)
+{
+    int src = get16(&pkt[2]), seq = get16(&pkt[4]);
+    int dest = get16(&pkt[6]), hop = get16(&pkt[8]);
+
+    /* Ignore unicast packets that another node should handle */
+    if (hop != MESH_BROADCAST && hop != m->id) return;
+
+    if (seen(m, src, seq)) {
+        m->stats.duplicates++;
+        if (hop == MESH_BROADCAST) overheard(m, src, seq);
+        return;
+    }
+    remember(m, src, seq);
+
+    pkt[10]++;                  /* One more hop */
+
+    if (dest == m->id || dest == MESH_BROADCAST) {
+        m->stats.delivered++;
+        (*m->deliver)(m, src, pkt[10], &pkt[MESH_HEADER], n-MESH_HEADER);
+        if (dest == m->id) return;
+    }
+
+    if (pkt[1] <= 1) {
+        /* Hop limit reached */
+        m->stats.dropped++;
+        return;
+    }
+    pkt[1]--;
+
+    if (dest == MESH_BROADCAST)
+        schedule(m, pkt, n, now);
+    else {
+        int r = lookup(m, dest);
+        if (r < 0) {
+            m->stats.dropped++;
+            return;
+        }
+        put16(&pkt[8], m->route[r].next);
+        m->stats.forwarded++;
+        (*m->output)(m, pkt, n);
+    }
+}
+
+/* mesh_input -- process a packet from the link */
+void mesh_input(mesh_node *m, const unsigned char *pkt, int n, unsigned now)
+{
+    unsigned char buf[MESH_HEADER+MESH_MAXDATA];
+
+    if (n < MESH_BHEADER) return;
+
+    switch (pkt[0]) {
+    case MESH_DATA:
+        if (n < MESH_HEADER || n > MESH_HEADER+MESH_MAXDATA) return;
+        memcpy(buf, pkt, n);    /* Keep a copy to change and forward */
+        data_input(m, buf, n, now);
+        break;
+
+    case MESH_BEACONPKT:
+        beacon_input(m, pkt, n, now);
+        break;
+    }
+}
+
+/* mesh_tick -- send rebroadcasts and beacons that are due */
+void mesh_tick(mesh_node *m, unsigned now)
+{
+    for (int i = 0; i < MESH_NPENDING; i++) {
+        if (m->pending[i].busy && (int) (now - m->pending[i].due) >= 0) {
+            m->pending[i].busy = 0;
+            m->stats.forwarded++;
+            (*m->output)(m, m->pending[i].pkt, m->pending[i].n);
+        }
+    }
+
+    for (int i = 0; i < MESH_NROUTES; i++) {
+        if (m->route[i].metric > 0
+            && now - m->route[i].updated > MESH_EXPIRE)
+            m->route[i].metric = 0;
+    }
+
+    if (m->next_beacon == 0 || (int) (now - m->next_beacon) >= 0) {
+        /* Jitter the interval so neighbours don't stay in step */
+        if (m->next_beacon != 0) send_beacon(m);
+        m->next_beacon = now + MESH_BEACON - MESH_BEACON/8
+            + next_random(m) % (MESH_BEACON/4);
+        if (m->next_beacon == 0) m->next_beacon = 1;
+    }
+}
+
+/* mesh_next -- time in usec until mesh_tick next has work to do */
+unsigned mesh_next(mesh_node *m, unsigned now)
+{
+    int wait;
+
+    if (m->next_beacon == 0) return 0;
+    wait = m->next_beacon - now;
+
+    for (int i = 0; i < MESH_NPENDING; i++) {
+        if (m->pending[i].busy && (int) (m->pending[i].due - now) < wait)
+            wait = m->pending[i].due - now;
+    }
+
+    for (int i = 0; i < MESH_NROUTES; i++) {
+        unsigned expire = m->route[i].updated + MESH_EXPIRE + 1;
+        if (m->route[i].metric > 0 && (int) (expire - now) < wait)
+            wait = expire - now;
+    }
+
+    return (wait > 0 ? wait : 0);
+}
@@ -0,0 +1,89 @@
+/* mesh.h */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Multi-hop flooding and routing over a broadcast link such as the
+radio.  Like reliable.c, mesh.c depends on nothing in microbian, so
+that a network of nodes can be simulated on a host computer; the
+process in meshnet.c connects one node to the radio. */
+
+#define MESH_BROADCAST 0xffff   /* Destination for flooding */
+
+#define MESH_HEADER 11          /* Bytes of header on a data packet */
+#define MESH_MAXDATA 100        /* Max bytes of data per packet */
+#define MESH_TTL 8              /* Initial hop limit */
+
+#define MESH_NCACHE 32          /* Entries in duplicate cache */
+#define MESH_NPENDING 4         /* Rebroadcasts that can wait at once */
+#define MESH_BACKOFF 4000       /* Max rebroadcast delay (usec) */
+#define MESH_SUPPRESS 2         /* Copies heard that cancel a rebroadcast */
+
+#define MESH_NROUTES 24         /* Entries in route table */
+#define MESH_INFINITY 16        /* Metric for an unreachable node */
+#define MESH_BEACON 1000000     /* Interval between beacons (usec) */
+#define MESH_EXPIRE 3500000     /* Time before a route is forgotten */
+
+/* Beacons are the longest packets, and must fit in a radio packet */
+#define MESH_MAXPACKET (6 + 5*MESH_NROUTES)
+
+/* mesh_stats -- counts of events at a node */
+struct mesh_stats {
+    unsigned sent;              /* Packets originated here */
+    unsigned delivered;         /* Packets passed to the client */
+    unsigned forwarded;         /* Packets sent on for others */
+    unsigned duplicates;        /* Copies received of packets seen before */
+    unsigned suppressed;        /* Rebroadcasts cancelled as unneeded */
+    unsigned dropped;           /* Packets lost for TTL, route or space */
+};
+
+typedef struct mesh_node {
+    unsigned short id;          /* Address of this node */
+    void (*output)(struct mesh_node *m, const unsigned char *pkt, int n);
+                                /* Function to broadcast a packet */
+    void (*deliver)(struct mesh_node *m, int src, int hops,
+                    const unsigned char *data, int n);
+                                /* Function to receive data */
+    void *user;                 /* For use by the client */
+
+    unsigned short seq;         /* Sequence number of next packet */
+    unsigned random;            /* State of random number generator */
+    unsigned next_beacon;       /* Time to send next beacon */
+    unsigned short beacon_seq;  /* Sequence number of next beacon */
+
+    /* Duplicate cache: recently seen (source, seq) pairs */
+    struct {
+        unsigned short src, seq;
+    } cache[MESH_NCACHE];
+    int c_next;
+
+    /* Rebroadcasts waiting for their backoff to expire */
+    struct {
+        int busy;               /* Whether this slot is used */
+        unsigned due;           /* Time to send */
+        int heard;              /* Copies heard from others meanwhile */
+        int n;                  /* Packet length */
+        unsigned char pkt[MESH_HEADER+MESH_MAXDATA];
+    } pending[MESH_NPENDING];
+
+    /* Distance-vector route table */
+    struct {
+        unsigned short dest;    /* Destination node */
+        unsigned short seq;     /* Latest sequence number from dest */
+        unsigned short next;    /* Neighbour to send to */
+        unsigned char metric;   /* Hops, or 0 if slot is empty */
+        unsigned updated;       /* Time last heard about */
+    } route[MESH_NROUTES];
+
+    struct mesh_stats stats;
+} mesh_node;
+
+/* Times passed as now are in microseconds, and may wrap around */
+
+void mesh_init(mesh_node *m, int id, unsigned seed,
+               void (*output)(mesh_node *m, const unsigned char *pkt, int n),
+               void (*deliver)(mesh_node *m, int src, int hops,
+                               const unsigned char *data, int n));
+int mesh_send(mesh_node *m, int dest, const void *buf, int n);
+void mesh_input(mesh_node *m, const unsigned char *pkt, int n, unsigned now);
+void mesh_tick(mesh_node *m, unsigned now);
+unsigned mesh_next(mesh_node *m, unsigned now);
+int mesh_route(mesh_node *m, int dest);
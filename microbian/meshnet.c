@@ -0,0 +1,195 @@
+/* meshnet.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "mesh.h"
+#include <string.h>
+
+/* A multi-hop network of micro:bits, using the protocol in mesh.c over
+the radio.  The Mesh process owns the node state: clients call
+meshnet_send and meshnet_receive, and a helper process MeshRx waits
+for radio packets and passes them to Mesh.  After each event, Mesh
+sets a one-shot timer for the next delayed rebroadcast or routing
+beacon, so it sleeps when there is nothing to do.  Each
+board takes its address from the factory-programmed device ID, so
+boards can be added to the network without configuring them.
+Arriving data waits in a small queue until a client asks for it, and
+is lost if the queue is full.  The mesh has its own radio protocol
+number, so other processes can use the radio too. */
+
+static int MESH_TASK;
+
+#define NQUEUE 4                /* Data packets that can wait */
+
+#define MESH_PACKET 16          /* Message type for packet from MeshRx */
+
+static mesh_node node;
+
+/* Queue of data waiting for a client */
+static struct {
+    int src, n;
+    unsigned char data[MESH_MAXDATA];
+} queue[NQUEUE];
+
+static int q_head = 0, q_count = 0;
+
+/* output -- send a packet by radio */
+static void output(mesh_node *m, const unsigned char *pkt, int n)
+{
+    radio_send_proto(RADIO_PROTO_MESH, (void *) pkt, n);
+}
+
+/* deliver -- add data for this node to the queue */
+static void deliver(mesh_node *m, int src, int hops,
+                    const unsigned char *data, int n)
+{
+    int i;
+
+    if (q_count == NQUEUE) {
+        m->stats.dropped++;
+        return;
+    }
+
+    i = (q_head + q_count++) % NQUEUE;
+    queue[i].src = src;
+    queue[i].n = n;
+    memcpy(queue[i].data, data, n);
+}
+
+/* mesh_rx_task -- pass packets from the radio to Mesh */
+static void mesh_rx_task(int dummy)
+{
+    static radio_buf spare;
+    radio_buf *p = &spare;
+    message m;
+
+    radio_listen(RADIO_PROTO_MESH, NULL, 0);
+
+    while (1) {
+        p = radio_receive_buf(p);
+        m.ptr1 = p;
+        sendrec(MESH_TASK, MESH_PACKET, &m);
+    }
+}
+
+/* set_alarm -- arrange a PING when mesh_tick next has work to do */
+static void set_alarm(void)
+{
+    /* The alarm may go off up to a tick early, so add 1 msec; if it
+       is still early, mesh_tick does nothing and we wait again */
+    unsigned wait = mesh_next(&node, timer_micros());
+    timer_cancel();
+    timer_alarm(wait/1000 + 1);
+}
+
+/* mesh_task -- process that runs the protocol */
+static void mesh_task(int arg)
+{
+    int receiver = 0, *rsrc = NULL;
+    void *rbuf = NULL;
+    message m;
+
+    set_alarm();
+
+    while (1) {
+        receive(ANY, &m);
+        switch (m.type) {
+        case PING:
+            mesh_tick(&node, timer_micros());
+            break;
+
+        case MESH_PACKET: {
+            radio_buf *p = m.ptr1;
+            mesh_input(&node, p->data, p->length-3, timer_micros());
+            send(m.sender, REPLY, NULL);
+            break;
+        }
+
+        case SEND:
+            m.int1 = mesh_send(&node, m.int3, m.ptr1, m.int2);
+            send(m.sender, REPLY, &m);
+            break;
+
+        case RECEIVE:
+            if (receiver != 0)
+                panic("meshnet supports only one receiver at a time");
+            receiver = m.sender;
+            rbuf = m.ptr1;
+            rsrc = m.ptr2;
+            break;
+
+        default:
+            badmesg(m.type);
+        }
+
+        /* Input, sending and ticks can all change what is due next */
+        if (m.type != RECEIVE) set_alarm();
+
+        /* See if a waiting client can have some data */
+        if (receiver != 0 && q_count > 0) {
+            memcpy(rbuf, queue[q_head].data, queue[q_head].n);
+            if (rsrc != NULL) *rsrc = queue[q_head].src;
+            m.int1 = queue[q_head].n;
+            q_head = (q_head+1) % NQUEUE; q_count--;
+            send(receiver, REPLY, &m);
+            receiver = 0;
+        }
+    }
+}
+
+/* meshnet_send -- send at most MESH_MAXDATA bytes to a node, or to
+   all nodes if dest is MESH_BROADCAST; return 0 if there is no route */
+int meshnet_send(int dest, void *buf, int n)
+{
+    message m;
+    m.ptr1 = buf;
+    m.int2 = n;
+    m.int3 = dest;
+    sendrec(MESH_TASK, SEND, &m);
+    return m.int1;
+}
+
+/* meshnet_receive -- receive the next datagram and return its length */
+int meshnet_receive(void *buf, int *src)
+{
+    /* buf must have space for MESH_MAXDATA bytes; the sender's
+       address is stored in *src unless src is NULL */
+    message m;
+    m.ptr1 = buf;
+    m.ptr2 = src;
+    sendrec(MESH_TASK, RECEIVE, &m);
+    return m.int1;
+}
+
+/* meshnet_id -- address of this node */
+int meshnet_id(void)
+{
+    return node.id;
+}
+
+/* meshnet_route -- next hop towards a node, or -1 if there is no route */
+int meshnet_route(int dest)
+{
+    return mesh_route(&node, dest);
+}
+
+/* meshnet_getstats -- fetch counts of protocol events */
+void meshnet_getstats(struct mesh_stats *st)
+{
+    *st = node.stats;
+}
+
+/* meshnet_init -- start the mesh process */
+void meshnet_init(void)
+{
+    unsigned dev = FICR.DEVICEID[0] ^ FICR.DEVICEID[1];
+    int id = (dev ^ (dev >> 16)) & 0xffff;
+
+    /* Avoid 0 and the broadcast address */
+    if (id == 0 || id == MESH_BROADCAST) id = 1;
+
+    mesh_init(&node, id, dev, output, deliver);
+    MESH_TASK = start("Mesh", mesh_task, 0, 512);
+    start("MeshRx", mesh_rx_task, 0, 256);
+}
@@ -31,6 +31,7 @@ struct _proc {
     int msgtype;              /* Message type to send or recieve */
     message *message;         /* Pointer to message buffer */
     proc next;                /* Next process in ready or send queue */
+    void *outbuf;             /* Output buffer for serial, or NULL */
 };
 
 /* Possible state values */
@@ -96,16 +97,6 @@ static proc idle_proc;
 static void kprintf_setup(void);
 static void kprintf_internal(char *fmt, ...);
 
-/* pad -- pad string with spaces to a specified width */
-static void pad(char *buf, int width)
-{
-    int w = strlen(buf);
-    if (w < width) {
-        memset(buf+w, ' ', width-w);
-        buf[width] = '\0';
-    }
-}
-
 /* state_name -- printable names for each process state */
 static const char *state_name[] = {
     "[DEAD]   ",
@@ -124,9 +115,6 @@ static void microbian_dump(void)
     kprintf_setup();
     kprintf_internal("\r\nPROCESS DUMP\r\n");
 
-    /* Our version of printf is a bit feeble, so the following is
-       more painful than it should be. */
-
     for (int pid = 0; pid < os_nprocs; pid++) {
         proc p = os_ptable[pid];
 
@@ -136,10 +124,8 @@ static void microbian_dump(void)
         unsigned free = (char *) z - (char *) p->stack;
 
         sprintf(buf, "%u/%u", p->stksize-free, p->stksize);
-        pad(buf, 9);
-        kprintf_internal("%s%d: %s %x stk=%s %s\r\n",
-                         (pid < 10 ? " " : ""), pid,
-                         state_name[p->state], (unsigned) p->stack,
+        kprintf_internal("%2d: %s %x stk=%-9s %s\r\n",
+                         pid, state_name[p->state], (unsigned) p->stack,
                          buf, p->name);
     }
 }
@@ -382,6 +368,24 @@ void priority(int p)
     os_current->priority = p;
 }
 
+/* getpid -- return process id of the current process */
+int getpid(void)
+{
+    return os_current->pid;
+}
+
+/* get_outbuf -- fetch the current process's output buffer */
+void *get_outbuf(void)
+{
+    return os_current->outbuf;
+}
+
+/* set_outbuf -- set the current process's output buffer */
+void set_outbuf(void *buf)
+{
+    os_current->outbuf = buf;
+}
+
 /* interrupt -- send interrupt message */
 void interrupt(int dest)
 {
@@ -467,6 +471,7 @@ static proc create_proc(char *name, unsigned stksize)
     p->msgtype = ANY;
     p->message = NULL;
     p->next = NULL;
+    p->outbuf = NULL;
 
     return p;
 }
@@ -22,6 +22,7 @@ typedef unsigned char byte;
 #define ERR 10
 #define SEND 11
 #define RECEIVE 12
+#define FINISHED 13
 #define ANY -1
 
 /* Possible priorities */
@@ -70,6 +71,13 @@ void connect(int irq);
 /* priority -- set process priority */
 void priority(int p);
 
+/* getpid -- return process id of the current process */
+int getpid(void);
+
+/* get_outbuf, set_outbuf -- per-process pointer used by serial_setbuf */
+void *get_outbuf(void);
+void set_outbuf(void *buf);
+
 /* exit -- terminate current process */
 void exit(void);
 
@@ -99,36 +107,199 @@ void spin(void);
 /* serial.c */
 void serial_putc(char ch);
 char serial_getc(void);
+int serial_readline(char *buf, int n);
+int serial_read(char *buf, int n, int timeout);
+void serial_write(const char *buf, int n);
+void serial_setbuf(char *buf, int size);
+void serial_flush(void);
 void serial_init(void);
 
 /* timer.c */
 void timer_delay(int msec);
 void timer_pulse(int msec);
+void timer_pulse_to(int pid, int msec);
+void timer_alarm(int msec);
+void timer_cancel(void);
 void timer_wait(void);
 unsigned timer_now(void);
 unsigned timer_micros(void);
+void timer_capture(int ch);
+unsigned timer_captured(void);
 void timer_init(void);
 
 /* i2c.c */
+
+/* i2c_req -- descriptor for an I2C transaction: write n1 bytes from
+   buf1, then read or write n2 bytes to or from buf2 */
+typedef struct i2c_req {
+    byte kind;                  /* READ or WRITE */
+    byte addr;                  /* Device address [0..127] */
+    unsigned short n1, n2;      /* Byte counts */
+    byte *buf1, *buf2;          /* Buffers */
+    struct i2c_req *next;       /* Next transaction in list */
+    int status;                 /* Result: OK or ERR */
+    int error;                  /* Hardware error bits if ERR */
+    /* Used by the driver */
+    struct i2c_req *link;       /* Next list in driver queue */
+    short client, reply;        /* Who to tell, and how */
+} i2c_req;
+
+void i2c_submit(int chan, i2c_req *list);
+int i2c_batch(int chan, i2c_req *list);
+int i2c_read_regs(int chan, int addr, const byte *regs, byte *vals, int n);
 int i2c_probe(int chan, int addr);
 int i2c_read_reg(int chan, int addr, int cmd);
 void i2c_write_reg(int chan, int addr, int cmd, int val);
 void i2c_read_bytes(int chan, int addr, int cmd, byte *buf, int n);
 void i2c_write_bytes(int chan, int addr, int cmd, byte *buf, int n);
+void i2c_update_reg(int chan, int addr, int cmd, int mask, int bits);
+void i2c_cache(int chan, int addr, int reg);
 int i2c_xfer(int chan, int kind, int addr,
              byte *buf1, int n1, byte *buf2, int n2);
+void i2c_frequency(int chan, int khz);
 void i2c_init(int chan);
 
 /* radio.c */
 #define RADIO_PACKET 128
+#define RADIO_MAXPREFIX 4       /* Max payload prefix for radio_listen */
+
+/* Protocol numbers for radio_listen and radio_send_proto */
+#define RADIO_PROTO_DATAGRAM 1  /* Used by radio_send */
+#define RADIO_PROTO_RLINK 2     /* rlink.c */
+#define RADIO_PROTO_TIMESYNC 3  /* timesync.c */
+#define RADIO_PROTO_MESH 4      /* meshnet.c */
+
+/* radio_buf -- buffer for a packet received with radio_receive_buf.
+   The radio writes the packet directly from length onwards. */
+typedef struct {
+    unsigned time;              /* Time address arrived (timer_micros) */
+    int rssi;                   /* Signal strength (dBm, negative) */
+    byte length;                /* Packet length, including 3-byte prefix */
+    byte version;               /* Version: 1, or 2 if encrypted */
+    byte group;                 /* Radio group that matched */
+    byte protocol;              /* Protocol number */
+    byte data[RADIO_PACKET];    /* Payload */
+} radio_buf;
+
+/* radio_stats -- counts of packets and errors */
+struct radio_stats {
+    unsigned sent;              /* Packets sent */
+    unsigned received;          /* Packets received and kept */
+    unsigned overruns;          /* Packets dropped because a queue was full */
+    unsigned unclaimed;         /* Packets that no process wanted */
+    unsigned crc_errors;        /* Packets with bad CRC */
+    unsigned auth_errors;       /* Packets that failed to decrypt */
+    unsigned replays;           /* Encrypted packets that were not new */
+};
+
 void radio_group(int group);
+void radio_subscribe(int group);
+void radio_config(int mode, int chan, int power);
+void radio_encrypt(const void *key);
+unsigned radio_airtime(int n);
+void radio_unsubscribe(int group);
 void radio_send(void *buf, int n);
+void radio_send_proto(int proto, void *buf, int n);
+unsigned radio_send_stamped(int proto, void *buf, int n);
+void radio_listen(int proto, const void *prefix, int n);
 int radio_receive(void *buf);
+radio_buf *radio_receive_buf(radio_buf *empty);
+void radio_getstats(struct radio_stats *st);
 void radio_init(void);
 
+/* timesync.c */
+
+/* timesync_stats -- state of time synchronisation */
+struct timesync_stats {
+    int synced;                 /* Whether global time is available */
+    int error;                  /* Error at the last reading (usec) */
+    int max_error;              /* Largest error so far (usec) */
+    int skew;                   /* Drift against the root (ppm) */
+    unsigned count;             /* Readings taken or SYNCs sent */
+};
+
+void timesync_init(int is_root);
+unsigned timer_global_micros(void);
+void timesync_getstats(struct timesync_stats *st);
+
+/* rlink.c -- see also reliable.h */
+struct rel_stats;
+void rlink_send(void *buf, int n);
+int rlink_receive(void *buf);
+void rlink_getstats(struct rel_stats *st);
+void rlink_init(int self, int peer, int window);
+
+/* meshnet.c -- see also mesh.h */
+struct mesh_stats;
+int meshnet_send(int dest, void *buf, int n);
+int meshnet_receive(void *buf, int *src);
+int meshnet_id(void);
+int meshnet_route(int dest);
+void meshnet_getstats(struct mesh_stats *st);
+void meshnet_init(void);
+
+/* log.c */
+
+/* LOG -- record a message for formatting on the host.  The format
+   string is stored in the non-loaded section .logfmt, and the arguments
+   (at most LOG_MAXARGS words) must be integers: strings cannot be
+   logged.  Each argument is stored as one 32-bit word, so a 64-bit
+   value for %ld, %lu or %lx must be split with LOG_U64(x), which
+   expands to two words, low word first, as logdecode expects. */
+#define LOG(fmt, ...)                                                   \
+    do {                                                                \
+        static const char _logfmt[]                                     \
+            __attribute((section(".logfmt"), used)) = fmt;              \
+        const unsigned _logargs[] = { 0, ##__VA_ARGS__ };               \
+        _Static_assert(sizeof(_logargs)/sizeof(unsigned) - 1            \
+                       <= LOG_MAXARGS, "Too many arguments to LOG");    \
+        log_event((unsigned) _logfmt,                                   \
+                  sizeof(_logargs)/sizeof(unsigned) - 1, &_logargs[1]); \
+    } while (0)
+
+/* LOG_U64 -- split a 64-bit LOG argument into two words */
+#define LOG_U64(x)                                                      \
+    (unsigned) (unsigned long long) (x),                                \
+    (unsigned) ((unsigned long long) (x) >> 32)
+
+#define LOG_MAXARGS 6
+#define LOG_SYNC 0xa5           /* First byte of each frame */
+#define LOG_VALID 0x80000000    /* Header bit: record is complete */
+#define LOG_NSHIFT 24           /* Position of argument count in header */
+#define LOG_NMASK 0x7f
+#define LOG_DROPPED 0xffffff    /* ID for count of dropped records */
+
+void log_event(unsigned id, int nargs, const unsigned *args);
+void log_init(void);
+
 /* display.c */
+#define DISPLAY_LEVELS 16       /* Brightness levels for greyscale */
+#define DISPLAY_FRAME 15        /* Time to show each frame (ms) */
+
 void display_show(const unsigned *img);
+void display_show_grey(const byte px[25]);
+void display_notify(void);
+void display_vsync(void);
 void display_init(void);
+unsigned display_latency(void);
 extern const unsigned blank[];
 void image_clear(unsigned *img);
 void image_set(int x, int y, unsigned *img);
+void image_shift(unsigned *img, unsigned col);
+
+/* neopixel.c */
+void neopixel_start(unsigned pin, const unsigned *buf, int n);
+void neopixel_show(unsigned pin, const unsigned *buf, int n);
+void neopixel_wait(void);
+void neopixel_init(void);
+
+/* pwm.c */
+#define PWM_NCHANS 16           /* Number of PWM channels */
+
+void pwm_connect(int chan, unsigned pin, unsigned period);
+void pwm_set(int chan, unsigned width);
+void pwm_reserve(int k);
+
+/* scroll.c */
+void display_scroll(const char *str, int ms_per_col);
+void scroll_init(void);
@@ -0,0 +1,269 @@
+/* neopixel.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+
+/* A driver for strings of Neopixels (WS2812 LEDs) that uses a PWM
+peripheral and EasyDMA to generate the signal, leaving the processor
+and interrupts free.  Each bit sent to the pixels is one PWM period of
+1.25us, and the duty cycle says whether it is a 0 or a 1; so each
+pixel needs 24 half-word samples.  Rather than hold a whole frame in
+that form, the driver encodes the frame a chunk at a time into two
+buffers that are played alternately as the two sequences of the PWM.
+When a sequence ends, the driver refills its buffer with the next
+chunk while the other one is playing, so strips of any length can be
+sent.  A frame ends with a stretch of low signal that makes the pixels
+show the new colours.
+
+A client can call neopixel_show, which returns when the frame has been
+sent, or neopixel_start, which returns as soon as the frame has begun
+to play; neopixel_wait then waits until the strip is idle.  Frames that
+arrive while the strip is busy wait in a short queue, with their
+clients waiting for a reply.  So the driver only ever replies to a
+process that is waiting in sendrec, and is never held up, even for an
+instant, while it needs to refill the sequence buffers.  The client's
+buffer must not change until the frame is finished, which is certainly
+true once a later frame has started. */
+
+static int NEO_TASK;
+
+#define NEO_PWM PWM3            /* PWM peripheral used for the signal */
+#define NEO_PWMNUM 3            /* Its index, for pwm_reserve */
+#define NEO_IRQ PWM3_IRQ
+
+#define NEO_START 16            /* Start a frame, reply when it starts */
+#define NEO_WAIT 17             /* Reply when the strip is idle */
+
+#define PERIOD 20               /* 1.25us at 16MHz */
+#define ZERO PWM_SAMPLE(6, FALLING) /* High for 0.375us */
+#define ONE PWM_SAMPLE(13, FALLING) /* High for 0.8125us */
+#define LOW PWM_SAMPLE(0, FALLING) /* Low throughout */
+
+#define CHUNK 16                /* Pixels in each buffer */
+#define CHUNK_WORDS (24*CHUNK)
+#define LATCH 48                /* Low periods at end of frame (60us) */
+
+#define NQUEUE 4                /* Frames that can wait */
+
+/* seqbuf -- the two buffers for sequences (in RAM for EasyDMA) */
+static unsigned short seqbuf[2][CHUNK_WORDS];
+
+/* queue -- frames waiting to be sent, the first being current */
+static struct {
+    int client;                 /* Process waiting for a reply */
+    int early;                  /* Whether to reply when the frame starts */
+    unsigned pin;               /* Pin for the strip */
+    const unsigned *buf;        /* Pixels in GRB format */
+    int n;                      /* Number of pixels */
+} queue[NQUEUE];
+
+static int q_head = 0, q_count = 0;
+
+static int waiter = 0;          /* Process waiting in neopixel_wait, or 0 */
+
+static int nwords;              /* Total samples in current frame */
+static int nchunks;             /* Chunks in frame, rounded up to even */
+static int next_chunk;          /* Next chunk to encode */
+
+/* encode -- fill a sequence buffer with a chunk of the current frame
+   and return the number of samples */
+static int encode(unsigned short *seq, int chunk)
+{
+    const unsigned *buf = queue[q_head].buf;
+    int pixwords = 24 * queue[q_head].n;
+    int start = chunk * CHUNK_WORDS, end = start + CHUNK_WORDS;
+    int i, k, n = 0;
+
+    if (end > nwords) end = nwords;
+
+    /* Whole pixels, because chunks start at a pixel boundary */
+    for (i = start; i < end && i < pixwords; i += 24) {
+        unsigned pix = buf[i/24];
+        for (k = 23; k >= 0; k--)
+            seq[n++] = (GET_BIT(pix, k) ? ONE : ZERO);
+    }
+
+    /* Then the low signal that latches the colours */
+    for (; i < end; i++)
+        seq[n++] = LOW;
+
+    /* The hardware needs something to play even in a padding chunk */
+    if (n == 0) seq[n++] = LOW;
+
+    return n;
+}
+
+/* start_frame -- begin sending the frame at the head of the queue */
+static void start_frame(void)
+{
+    unsigned pin = queue[q_head].pin;
+
+    nwords = 24 * queue[q_head].n + LATCH;
+    nchunks = (nwords + CHUNK_WORDS - 1) / CHUNK_WORDS;
+    if (nchunks % 2 != 0) nchunks++;
+
+    /* The pin is low while the PWM is not driving it */
+    gpio_out(pin, 0);
+    gpio_dir(pin, 1);
+    NEO_PWM.ENABLE = 0;
+    NEO_PWM.PSEL[0] = pin;
+    NEO_PWM.ENABLE = 1;
+
+    NEO_PWM.SEQ[0].PTR = seqbuf[0];
+    NEO_PWM.SEQ[0].CNT = encode(seqbuf[0], 0);
+    NEO_PWM.SEQ[1].PTR = seqbuf[1];
+    NEO_PWM.SEQ[1].CNT = encode(seqbuf[1], 1);
+    next_chunk = 2;
+
+    /* The two sequences are played alternately, a pair at a time */
+    NEO_PWM.LOOP = nchunks/2;
+    NEO_PWM.SEQSTART[0] = 1;
+
+    /* The client of neopixel_start can go on at once */
+    if (queue[q_head].early)
+        send(queue[q_head].client, REPLY, NULL);
+}
+
+/* finish_frame -- start the next frame if any and tell the client */
+static void finish_frame(void)
+{
+    int client = queue[q_head].client, early = queue[q_head].early;
+
+    NEO_PWM.ENABLE = 0;
+    NEO_PWM.PSEL[0] = 0xffffffff; /* Disconnect */
+    q_head = (q_head+1) % NQUEUE; q_count--;
+    if (q_count > 0) start_frame();
+
+    /* Clients are waiting in sendrec, so the replies do not block */
+    if (! early)
+        send(client, REPLY, NULL);
+    if (q_count == 0 && waiter != 0) {
+        send(waiter, REPLY, NULL);
+        waiter = 0;
+    }
+}
+
+/* neo_interrupt -- handle an interrupt from the PWM */
+static void neo_interrupt(void)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (NEO_PWM.SEQEND[i]) {
+            /* Sequence i has finished, and the other one is playing */
+            NEO_PWM.SEQEND[i] = 0;
+            if (next_chunk < nchunks)
+                NEO_PWM.SEQ[i].CNT = encode(seqbuf[i], next_chunk++);
+        }
+    }
+
+    if (NEO_PWM.STOPPED) {
+        NEO_PWM.STOPPED = 0;
+        finish_frame();
+    }
+
+    clear_pending(NEO_IRQ);
+    enable_irq(NEO_IRQ);
+}
+
+/* neo_task -- driver process for Neopixels */
+static void neo_task(int dummy)
+{
+    message m;
+    int i;
+
+    NEO_PWM.ENABLE = 0;
+    for (i = 0; i < 4; i++)
+        NEO_PWM.PSEL[i] = 0xffffffff;
+    NEO_PWM.MODE = PWM_MODE_Up;
+    NEO_PWM.PRESCALER = 0;      /* 16MHz */
+    NEO_PWM.COUNTERTOP = PERIOD;
+    NEO_PWM.DECODER = FIELD(PWM_DECODER_LOAD, PWM_LOAD_Common)
+        | FIELD(PWM_DECODER_MODE, PWM_MODE_RefreshCount);
+    for (i = 0; i < 2; i++) {
+        NEO_PWM.SEQ[i].REFRESH = 0;
+        NEO_PWM.SEQ[i].ENDDELAY = 0;
+    }
+    NEO_PWM.SHORTS = BIT(PWM_LOOPSDONE_STOP);
+    NEO_PWM.INTEN = BIT(PWM_INT_SEQEND0) | BIT(PWM_INT_SEQEND1)
+        | BIT(PWM_INT_STOPPED);
+
+    connect(NEO_IRQ);
+    enable_irq(NEO_IRQ);
+
+    while (1) {
+        receive(ANY, &m);
+
+        switch (m.type) {
+        case INTERRUPT:
+            neo_interrupt();
+            break;
+
+        case NEO_START:
+        case SEND: {
+            int k = (q_head + q_count) % NQUEUE;
+
+            if (q_count == NQUEUE)
+                panic("Too many Neopixel frames waiting");
+
+            queue[k].client = m.sender;
+            queue[k].early = (m.type == NEO_START);
+            queue[k].pin = m.int1;
+            queue[k].buf = m.ptr2;
+            queue[k].n = m.int3;
+            if (q_count++ == 0) start_frame();
+            break;
+        }
+
+        case NEO_WAIT:
+            if (q_count == 0)
+                send(m.sender, REPLY, NULL);
+            else if (waiter != 0)
+                panic("Only one process can wait for the Neopixels");
+            else
+                waiter = m.sender;
+            break;
+
+        default:
+            badmesg(m.type);
+        }
+    }
+}
+
+/* neopixel_start -- start sending a frame without waiting for it */
+void neopixel_start(unsigned pin, const unsigned *buf, int n)
+{
+    /* Returns when any earlier frames have been sent and this one has
+       begun; use neopixel_wait before changing buf. */
+    message m;
+    m.int1 = pin;
+    m.ptr2 = (void *) buf;
+    m.int3 = n;
+    sendrec(NEO_TASK, NEO_START, &m);
+}
+
+/* neopixel_show -- send a frame of n pixels and wait until it is done */
+void neopixel_show(unsigned pin, const unsigned *buf, int n)
+{
+    message m;
+    m.int1 = pin;
+    m.ptr2 = (void *) buf;
+    m.int3 = n;
+    sendrec(NEO_TASK, SEND, &m);
+}
+
+/* neopixel_wait -- wait until all frames have been sent */
+void neopixel_wait(void)
+{
+    message m;
+    sendrec(NEO_TASK, NEO_WAIT, &m);
+}
+
+/* neopixel_init -- start the driver process */
+void neopixel_init(void)
+{
+    /* Make sure pwm_connect does not use the same peripheral */
+    pwm_reserve(NEO_PWMNUM);
+    NEO_TASK = start("Neopixel", neo_task, 0, 256);
+}
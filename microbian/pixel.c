@@ -0,0 +1,162 @@
+/* pixel.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "pixel.h"
+
+/* DIV255 -- divide by 255, exact for 0 <= x <= 255*255 */
+#define DIV255(x) (((x) + ((x) >> 8) + 1) >> 8)
+
+/* The gamma table is computed by the compiler.  The curve is the
+average of x^2 and x^3 (scaled to 0..255), which is close to the
+usual gamma of 2.2 to 2.5 and needs only integer arithmetic. */
+
+#define GAMMA(x) (((x)*(x)*255 + (x)*(x)*(x)) / (2*255*255))
+#define G4(x) GAMMA(x), GAMMA(x+1), GAMMA(x+2), GAMMA(x+3)
+#define G16(x) G4(x), G4(x+4), G4(x+8), G4(x+12)
+#define G64(x) G16(x), G16(x+16), G16(x+32), G16(x+48)
+
+/* gamma_lut -- table of corrected intensities */
+static const unsigned char gamma_lut[256] = {
+    G64(0), G64(64), G64(128), G64(192)
+};
+
+/* lut -- gamma table scaled for the global brightness */
+static unsigned char lut[256] = {
+    G64(0), G64(64), G64(128), G64(192)
+};
+
+/* pix_hsv -- convert hue, saturation and value to a colour */
+unsigned pix_hsv(unsigned h, unsigned s, unsigned v)
+{
+    /* Hue goes round from red (0) through green (512) and blue
+       (1024); saturation and value go from 0 to 255 */
+    unsigned f, p, q, t;
+
+    if (h >= PIX_HUES) h %= PIX_HUES;
+    f = h & 0xff;
+    p = DIV255(v * (255 - s));
+    q = DIV255(v * (255 - DIV255(s * f)));
+    t = DIV255(v * (255 - DIV255(s * (255 - f))));
+
+    switch (h >> 8) {
+    case 0:
+        return PIX_RGB(v, t, p);
+    case 1:
+        return PIX_RGB(q, v, p);
+    case 2:
+        return PIX_RGB(p, v, t);
+    case 3:
+        return PIX_RGB(p, q, v);
+    case 4:
+        return PIX_RGB(t, p, v);
+    default:
+        return PIX_RGB(v, p, q);
+    }
+}
+
+/* pix_fill -- set every pixel to the same colour */
+void pix_fill(unsigned *buf, int n, unsigned c)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        buf[i] = c;
+}
+
+/* pix_gradient -- blend from one colour to another along the frame */
+void pix_gradient(unsigned *buf, int n, unsigned c1, unsigned c2)
+{
+    /* Each component is kept with 16 fraction bits, so the loop only
+       adds a step to each; starting at one half rounds the result */
+    int r = PIX_R(c1) << 16, g = PIX_G(c1) << 16, b = PIX_B(c1) << 16;
+    int dr = 0, dg = 0, db = 0, i;
+
+    if (n > 1) {
+        dr = (((int) PIX_R(c2) << 16) - r) / (n-1);
+        dg = (((int) PIX_G(c2) << 16) - g) / (n-1);
+        db = (((int) PIX_B(c2) << 16) - b) / (n-1);
+    }
+
+    r += 0x8000; g += 0x8000; b += 0x8000;
+
+    for (i = 0; i < n; i++) {
+        buf[i] = PIX_RGB(r >> 16, g >> 16, b >> 16);
+        r += dr; g += dg; b += db;
+    }
+}
+
+/* pix_rainbow -- fill with hues starting at h and stepping by dh */
+void pix_rainbow(unsigned *buf, int n, unsigned h, unsigned dh,
+                 unsigned s, unsigned v)
+{
+    int i;
+
+    h %= PIX_HUES; dh %= PIX_HUES;
+
+    for (i = 0; i < n; i++) {
+        buf[i] = pix_hsv(h, s, v);
+        h += dh;
+        if (h >= PIX_HUES) h -= PIX_HUES;
+    }
+}
+
+/* reverse -- reverse part of a frame in place */
+static void reverse(unsigned *buf, int i, int j)
+{
+    unsigned t;
+
+    for (j--; i < j; i++, j--) {
+        t = buf[i]; buf[i] = buf[j]; buf[j] = t;
+    }
+}
+
+/* pix_rotate -- move every pixel k places along, wrapping round */
+void pix_rotate(unsigned *buf, int n, int k)
+{
+    /* Three reversals make a rotation without extra space */
+    if (n <= 1) return;
+    k %= n;
+    if (k < 0) k += n;
+    if (k == 0) return;
+    reverse(buf, 0, n);
+    reverse(buf, 0, k);
+    reverse(buf, k, n);
+}
+
+/* pix_fade -- scale every pixel by f/256 */
+void pix_fade(unsigned *buf, int n, unsigned f)
+{
+    /* Green and blue are 16 bits apart, so one multiply scales both
+       without overlap; red needs another. */
+    int i;
+    unsigned c;
+
+    for (i = 0; i < n; i++) {
+        c = buf[i];
+        buf[i] = (((c & 0xff00ff) * f >> 8) & 0xff00ff)
+            | (((c & 0xff00) * f >> 8) & 0xff00);
+    }
+}
+
+/* pix_brightness -- set global brightness from 0 to 255 */
+void pix_brightness(unsigned b)
+{
+    int i;
+
+    if (b > 255) b = 255;
+    for (i = 0; i < 256; i++)
+        lut[i] = gamma_lut[DIV255(i * b)];
+}
+
+/* pix_render -- correct a frame for gamma and brightness */
+void pix_render(unsigned *out, const unsigned *in, int n)
+{
+    int i;
+    unsigned c;
+
+    for (i = 0; i < n; i++) {
+        c = in[i];
+        out[i] = (lut[c >> 16 & 0xff] << 16)
+            | (lut[c >> 8 & 0xff] << 8) | lut[c & 0xff];
+    }
+}
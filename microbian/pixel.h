@@ -0,0 +1,30 @@
+/* pixel.h */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* A pipeline for frames of Neopixel colours.  Effects work on frames
+of logical colours, and pix_render produces the frame that is sent,
+correcting each component for the eye's response (gamma) and scaling
+it for the global brightness with a single table lookup.  Like
+reliable.c, pixel.c depends on nothing in microbian, so it can be
+tested and timed anywhere. */
+
+/* Colours are packed in the GRB order used by Neopixels */
+#define PIX_RGB(r, g, b) \
+    ((((g) & 0xff) << 16) | (((r) & 0xff) << 8) | ((b) & 0xff))
+#define PIX_R(c) (((c) >> 8) & 0xff)
+#define PIX_G(c) (((c) >> 16) & 0xff)
+#define PIX_B(c) ((c) & 0xff)
+
+#define PIX_HUES 1536           /* Hues in a full circle: 6 x 256 */
+
+unsigned pix_hsv(unsigned h, unsigned s, unsigned v);
+
+void pix_fill(unsigned *buf, int n, unsigned c);
+void pix_gradient(unsigned *buf, int n, unsigned c1, unsigned c2);
+void pix_rainbow(unsigned *buf, int n, unsigned h, unsigned dh,
+                 unsigned s, unsigned v);
+void pix_rotate(unsigned *buf, int n, int k);
+void pix_fade(unsigned *buf, int n, unsigned f);
+
+void pix_brightness(unsigned b);
+void pix_render(unsigned *out, const unsigned *in, int n);
@@ -0,0 +1,105 @@
+/* pwm.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+
+/* A driver for the four PWM peripherals, giving up to 16 channels of
+pulse width modulation for servos and motors.  Channel c uses output
+c%4 of PWM[c/4], and the four channels of each peripheral share a
+period.  Each peripheral counts at 1MHz and plays an endless sequence
+from a four-word buffer in RAM, one word per channel, with the two
+sequences both pointing at the same buffer and a shortcut that starts
+again when they finish.  The compare values are fetched by EasyDMA at
+the start of each period, so a new width set with pwm_set takes effect
+cleanly at the next period without any interrupt or process: there is
+no driver process at all.  A width of 0 gives no pulses.  PWM3 is also
+used by the Neopixel driver, so channels 12 to 15 are not available in
+programs that use Neopixels: another driver claims a peripheral with
+pwm_reserve, and whichever of the two comes second panics. */
+
+#define NPWM 4                  /* Number of PWM peripherals */
+
+/* seq -- buffer of compare values for each peripheral */
+static volatile unsigned short seq[NPWM][4];
+
+/* period -- period in usec for each peripheral, or 0 if not started */
+static unsigned period[NPWM];
+
+/* reserved -- bitmap of peripherals claimed by other drivers */
+static unsigned reserved = 0;
+
+/* pwm_start -- start a PWM peripheral with a given period */
+static void pwm_start(int k, unsigned per)
+{
+    volatile _DEVICE _pwm *pwm = PWM[k];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        seq[k][i] = PWM_SAMPLE(0, FALLING);
+        pwm->PSEL[i] = 0xffffffff;
+    }
+
+    pwm->ENABLE = 1;
+    pwm->MODE = PWM_MODE_Up;
+    pwm->PRESCALER = 4;         /* 1MHz = 16MHz / 2^4 */
+    pwm->COUNTERTOP = per;
+    pwm->DECODER = FIELD(PWM_DECODER_LOAD, PWM_LOAD_Individual)
+        | FIELD(PWM_DECODER_MODE, PWM_MODE_RefreshCount);
+    for (i = 0; i < 2; i++) {
+        pwm->SEQ[i].PTR = (void *) seq[k];
+        pwm->SEQ[i].CNT = 4;
+        pwm->SEQ[i].REFRESH = 0;
+        pwm->SEQ[i].ENDDELAY = 0;
+    }
+    pwm->LOOP = 1;
+    pwm->SHORTS = BIT(PWM_LOOPSDONE_SEQSTART0);
+    pwm->SEQSTART[0] = 1;
+
+    period[k] = per;
+}
+
+/* pwm_connect -- attach a pin to a channel with a period in usec */
+void pwm_connect(int chan, unsigned pin, unsigned per)
+{
+    int k = chan/4;
+
+    if (chan < 0 || chan >= PWM_NCHANS)
+        panic("No such PWM channel %d", chan);
+    if (per == 0 || per >= 0x8000)
+        panic("Bad PWM period %d", per);
+    if (GET_BIT(reserved, k))
+        panic("PWM channels %d to %d are used by another driver",
+              4*k, 4*k+3);
+
+    if (period[k] == 0)
+        pwm_start(k, per);
+    else if (period[k] != per)
+        panic("PWM channels %d to %d already have period %d",
+              4*k, 4*k+3, period[k]);
+
+    /* The pin is low except when the PWM is driving it high */
+    gpio_out(pin, 0);
+    gpio_dir(pin, 1);
+    PWM[k]->PSEL[chan%4] = pin;
+}
+
+/* pwm_reserve -- claim a PWM peripheral for another driver */
+void pwm_reserve(int k)
+{
+    if (k < 0 || k >= NPWM)
+        panic("No such PWM peripheral %d", k);
+    if (period[k] != 0 || GET_BIT(reserved, k))
+        panic("PWM%d is already in use", k);
+    SET_BIT(reserved, k);
+}
+
+/* pwm_set -- set the pulse width for a channel in usec */
+void pwm_set(int chan, unsigned width)
+{
+    /* The output is high for the first width usec of each period */
+    if (chan < 0 || chan >= PWM_NCHANS)
+        panic("No such PWM channel %d", chan);
+    if (width > period[chan/4]) width = period[chan/4];
+    seq[chan/4][chan%4] = PWM_SAMPLE(width, FALLING);
+}
@@ -3,167 +3,897 @@
 
 #include "microbian.h"
 #include "hardware.h"
+#include "ccmlink.h"
 #include <string.h>
 
 /* RADIO_TASK -- process id for device driver */
 static int RADIO_TASK;
 
-/* Operating modes */
-#define ASLEEP 0                /* Doing nothing */
-#define AWAKE 1                 /* Initialised for reception */
-#define LISTENING 2             /* Waiting for a packet, DMA set up */
+#define FREQ 7                  /* Default frequency 2407 MHz */
 
-#define FREQ 7                  /* Frequency 2407 MHz */
+/* The data rate, channel and transmit power can be changed with
+radio_config.  The radio must be disabled to change them, so the
+driver waits until any packets in the queue have been sent, stops
+listening, writes the registers and starts listening again.  The
+2Mbit modes need a 16-bit preamble.  radio_airtime gives the time on
+air for a packet in the current mode, so that programs can work out
+the best throughput they can hope for. */
+
+#define RADIO_CONFIG 16         /* Message type for changing settings */
+
+static int mode = RADIO_MODE_NRF_1Mbit; /* Current data rate */
+static int config_client = 0;   /* Process waiting for radio_config */
+static int config_kind;         /* RADIO_CONFIG, RADIO_ENCRYPT, RADIO_ADDRS */
+static int new_mode, new_chan, new_power; /* Its settings */
 
 /* We use a packet format that agrees with the standard micro:bit
 runtime.  That means prefixing the packet with three bytes (version,
 group, protocol) and counting these three in the length: the STATLEN
 feature of the radio is not used. */
 
+/* Packets are held in radio_buf structures, defined in microbian.h:
+the radio reads or writes the packet starting at the length field,
+and there is space before it for the signal strength and arrival time
+of a received packet. */
+
+/* Several processes can share the radio, each receiving only the
+packets it wants.  A process subscribes with radio_listen, giving a
+protocol number, which the sender puts in the third byte of the
+prefix, and optionally a few bytes that the payload must start with.
+A process that calls radio_receive without subscribing is taken to
+want all packets sent by radio_send, which have protocol
+RADIO_PROTO_DATAGRAM.
+
+Once a process has subscribed, the radio listens all the time, except
+while it is sending.  Received packets go into buffers taken from a
+pool of NBUF, and as soon as a packet has been received, the driver
+starts the radio listening again for the next one, before dealing
+with the packet.  Each subscriber has a queue of up to NSUBQ packets,
+and a packet is added to the queue of every subscriber that matches
+it, copied into a fresh buffer for the second and later ones.  So a
+sender can fire a burst of packets and they will be kept until the
+receivers ask for them, and if one subscriber is slow to collect its
+packets, only that subscriber loses them when its queue is full; the
+others carry on.  The pool is big enough for every queue to be full
+with one buffer to spare, so the radio always has somewhere to put a
+packet.  Packets that lost out because a queue was full count as
+overruns, and packets that nobody wanted are counted as unclaimed.
+
+The queues hold pointers to buffers, so that a client can receive
+without copying by calling radio_receive_buf: it gives the driver an
+empty buffer, and gets back the buffer at the head of its queue, with
+the empty one going into the pool.  The RSSI is measured automatically
+using the shortcut ADDRESS_RSSISTART. */
+
+#define NSUB 4                  /* Max subscribers */
+#define NSUBQ 4                 /* Packets queued for each subscriber */
+#define NBUF (NSUB*NSUBQ+1)     /* Buffers in the pool */
+#define RX_SHORTS (BIT(RADIO_READY_START) | BIT(RADIO_ADDRESS_RSSISTART))
+
+#define RADIO_LISTEN 17         /* Message type for subscribing */
+
+/* sub -- subscribers and their queues */
+static struct sub {
+    int client;                 /* Subscribing process, or 0 if unused */
+    int proto;                  /* Protocol number wanted */
+    int plen;                   /* Length of payload prefix */
+    byte prefix[RADIO_MAXPREFIX]; /* Payload prefix to match */
+    radio_buf *queue[NSUBQ];    /* Packets waiting */
+    int head, count;            /* Oldest packet and number waiting */
+    int waiting;                /* Whether the client is waiting */
+    void *buf;                  /* Client's buffer */
+    int swap;                   /* Whether to swap buffers or copy */
+} sub[NSUB];
+
+static radio_buf rx_pool[NBUF];     /* Initial buffers for the pool */
+static radio_buf *rx_free[NBUF];    /* Stack of free buffers */
+static int n_free = 0;              /* Number of free buffers */
+static radio_buf rx_spare;          /* For packets that won't fit */
+static radio_buf *rx_cur = NULL;    /* Buffer the radio is filling */
+static int listening = 0;           /* Whether to receive when idle */
+
+/* Packets to send are copied into a queue, and radio_send returns
+at once unless the queue is full.  Transmission uses the shortcuts
+READY_START and END_DISABLE, so that a packet goes out without help
+from the driver once TXEN has been triggered.  A third shortcut
+chooses what happens when the radio has been disabled: DISABLED_TXEN
+if there is another packet waiting, so that queued packets go out
+back-to-back, or DISABLED_RXEN to go back to listening.  The only
+interrupt is END: at the end of a packet, the driver waits the few
+microseconds until the radio is disabled, then looks at the radio
+state to see which way it went, and gives it the next packet buffer
+during the ramp-up, which takes 40 usec with the fast ramp-up
+selected by MODECNF0.  If a packet is queued too late for the
+shortcut, the driver starts it itself.
+
+A PPI channel makes the ADDRESS event of every packet, sent or
+received, trigger a capture of the time (see timer_capture), and
+timer_captured turns this into a time on the same clock as
+timer_micros.  So a
+received packet is stamped with the time its address was seen, not
+the time the driver got round to it, and radio_send_stamped, which
+waits until the packet has gone, returns the time it was sent.  These
+times are accurate to a microsecond or so, as needed by timesync.c. */
+
+#define RADIO_PPI 8             /* PPI channel for timestamps */
+
+#define NTX 4                   /* Number of buffers in the queue */
+
+static radio_buf tx_queue[NTX];     /* Queue of packets to send */
+static int tx_head = 0;             /* Index of packet being sent */
+static int tx_count = 0;            /* Number of packets in queue */
+static int sending = 0;             /* Whether tx_queue[tx_head] is active */
+static int tx_notify[NTX];          /* Client waiting for each timestamp */
+
+/* After radio_encrypt, every packet is encrypted and authenticated by
+the CCM peripheral with AES in CCM mode, in the format described in
+ccmlink.h, and packets that are not encrypted with the same key are
+dropped.  Encryption is done in-line: a PPI channel starts the CCM
+when the radio has ramped up to send (TXREADY), and with the shortcut
+ENDKSGEN_CRYPT, the CCM generates the key stream and encrypts the
+packet from the queue into tx_cipher while the radio is sending the
+preamble, address and clear header, so it adds no time beyond the
+extra CCM_OVERHEAD bytes on air.  The receiver cannot do the same,
+because the nonce depends on the sender and counter in the packet
+itself; instead, the radio receives into one of two cipher buffers,
+and the driver starts the CCM as soon as it has set the radio
+listening again, decrypting into a buffer from the pool and checking
+the MIC.  For a full-size packet that takes a few tens of
+microseconds, and the bench program in x20-radio measures what it
+adds to the round trip.  A packet whose counter is not newer than the
+last one accepted from the same sender is dropped as a replay, using
+the table described in ccmlink.h. */
+
+#define CCM_PPI 9               /* PPI channel that starts encryption */
+#define RADIO_ENCRYPT 18        /* Message type for radio_encrypt */
+
+/* CIPHER_LEN -- max length byte of an encrypted packet */
+#define CIPHER_LEN (RADIO_PACKET+3+CCM_OVERHEAD)
+
+/* cipher_buf -- an encrypted packet as it is sent or received */
+typedef struct {
+    unsigned time;              /* Time the address arrived */
+    int rssi;                   /* Signal strength */
+    int group;                  /* Group that matched */
+    byte pkt[CIPHER_LEN+1];     /* Length byte, then the packet */
+} cipher_buf;
+
+static int encrypting = 0;          /* Whether radio_encrypt is in force */
+static struct ccm_cnf tx_cnf, rx_cnf; /* Key and nonce for each way */
+static struct ccm_counter tx_ctr;   /* Counter for packets we send */
+static struct ccm_replay rx_replay; /* Last counter from each sender */
+static unsigned my_addr;            /* Our address in the nonce */
+static byte ccm_scratch[16+RADIO_PACKET+CCM_MIC]; /* Work area for CCM */
+static cipher_buf tx_cipher;        /* Packet being sent */
+static cipher_buf rx_cipher[2];     /* Packets being received */
+static int rx_ck = 0;               /* Which one the radio is filling */
+static cipher_buf *rx_crypt = NULL; /* Packet waiting to be decrypted */
+static byte new_key[16];            /* Key from radio_encrypt */
+static int new_encrypt;             /* Whether to encrypt */
+
+#define NWAIT 8                 /* Max clients waiting to send */
+
+/* waiting -- clients waiting for space in the queue */
 static struct {
-    byte length;                /* Packet length, including 3-byte prefix */
-    byte version;               /* Version: always 1 */
-    byte group;                 /* Radio group */
-    byte protocol;              /* Protocol identifier: always 1 */
-    byte data[RADIO_PACKET];    /* Payload */
-} packet_buffer;
+    int client;                 /* Process waiting */
+    void *buf;                  /* Payload */
+    int n;                      /* Payload length */
+    int proto;                  /* Protocol number */
+    int stamp;                  /* Whether the client wants a timestamp */
+} waiting[NWAIT];
+
+static int wt_head = 0, n_wait = 0;
+
+static struct radio_stats stats;    /* Counts of packets and errors */
+
+/* The radio address of a packet is made from a 4-byte base address
+and a 1-byte prefix, and the micro:bit runtime uses the group number
+as the prefix.  So the radio itself can filter packets by group: there
+are 8 logical addresses, numbered 0 to 7, each with its own prefix
+byte in PREFIX0 or PREFIX1, and the bits of RXADDRESSES say which of
+them to listen on.  Packets for other groups are rejected as soon as
+the address has been seen, before any interrupt.  Logical address 0
+holds the group set with radio_group, which is also used for sending;
+addresses 1 to 7 hold extra groups added with radio_subscribe.  RXMATCH
+tells which address matched, and the driver puts the corresponding
+group in the header of the received packet.  The registers can be
+changed only when the radio is disabled, so radio_group and friends
+send a RADIO_ADDRS message, and the driver makes the change in the
+same way as for radio_config. */
+
+#define NADDR 8                 /* Number of logical addresses */
+#define RADIO_ADDRS 19          /* Message type for changing groups */
+
+/* group -- group id for sending radio messages */
+static int group = 0;
+
+static byte prefix[NADDR];      /* Group for each logical address */
+static unsigned rx_addrs = BIT(0); /* Addresses to listen on */
+static int addr_op, addr_group; /* Pending change from RADIO_ADDRS */
+static volatile int running = 0; /* Whether the driver has started */
+
+#define RADIO_ADDR_SET 0        /* Set the group for sending */
+#define RADIO_ADDR_ADD 1        /* Listen to another group */
+#define RADIO_ADDR_DROP 2       /* Stop listening to a group */
+
+/* set_addresses -- load the prefix registers */
+static void set_addresses(void)
+{
+    RADIO.PREFIX0 = prefix[0] | (prefix[1] << 8)
+        | (prefix[2] << 16) | (prefix[3] << 24);
+    RADIO.PREFIX1 = prefix[4] | (prefix[5] << 8)
+        | (prefix[6] << 16) | (prefix[7] << 24);
+    RADIO.RXADDRESSES = rx_addrs;
+}
+
+/* change_group -- set, add or remove a group */
+static void change_group(int op, int grp)
+{
+    int free = -1;
 
-/* group -- group id for radio messages */
-static volatile int group = 0;
+    switch (op) {
+    case RADIO_ADDR_SET:
+        prefix[0] = group = grp;
+        break;
+
+    case RADIO_ADDR_ADD:
+        for (int i = 0; i < NADDR; i++) {
+            if (rx_addrs & BIT(i)) {
+                if (prefix[i] == grp) return;
+            } else if (free < 0)
+                free = i;
+        }
+
+        if (free < 0) panic("radio supports only %d groups", NADDR);
+        prefix[free] = grp;
+        SET_BIT(rx_addrs, free);
+        break;
+
+    case RADIO_ADDR_DROP:
+        /* The group set by radio_group is always received */
+        for (int i = 1; i < NADDR; i++) {
+            if ((rx_addrs & BIT(i)) && prefix[i] == grp)
+                CLR_BIT(rx_addrs, i);
+        }
+        break;
+    }
+}
+
+/* packet_format -- set the packet format, with a max length */
+static void packet_format(int maxlen)
+{
+    RADIO.PCNF1 = BIT(RADIO_PCNF1_WHITEEN) /* Whitening enabled */
+        | FIELD(RADIO_PCNF1_BALEN, 4) /* Base address is 4 bytes */
+        | FIELD(RADIO_PCNF1_MAXLEN, maxlen)
+        | FIELD(RADIO_PCNF1_ENDIAN, RADIO_ENDIAN_Little);
+                                /* Fields transmitted LSB first */
+}
 
 /* init_radio -- initialise radio hardware */
 static void init_radio()
 {
     RADIO.TXPOWER = 0;          /* Default transmit power */
     RADIO.FREQUENCY = FREQ;     /* Transmission frequency */
-    RADIO.MODE = RADIO_MODE_NRF_1Mbit; /* 1Mbit/sec data rate */
+    RADIO.MODE = mode;          /* 1Mbit/sec data rate */
     RADIO.BASE0 = 0x75626974;   /* That spells 'ubit' */
+    RADIO.BASE1 = 0x75626974;   /*   for addresses 4 to 7 too */
     RADIO.TXADDRESS = 0;        /* Use address 0 for transmit */
-    RADIO.RXADDRESSES = BIT(0); /*   and also (just one) for receive. */
 
     /* Basic configuration */
     RADIO.PCNF0 = FIELD(RADIO_PCNF0_LFLEN, 8); /* One 8-bit length field */
-    RADIO.PCNF1 = BIT(RADIO_PCNF1_WHITEEN) /* Whitening enabled */
-        | FIELD(RADIO_PCNF1_BALEN, 4) /* Base address is 4 bytes */
-        | FIELD(RADIO_PCNF1_MAXLEN, RADIO_PACKET+3)
-                                /* Max packet length allows for 3 byte prefix */
-        | FIELD(RADIO_PCNF1_ENDIAN, RADIO_ENDIAN_Little);
-                                /* Fields transmitted LSB first */
+    packet_format(RADIO_PACKET+3); /* Max length allows for 3 byte prefix */
 
     /* CRC and whitening settings -- match micro_bit runtime */
     RADIO.CRCCNF = 2;           /* CRC is 2 bytes */
     RADIO.CRCINIT = 0xffff;
     RADIO.CRCPOLY = 0x11021;
     RADIO.DATAWHITEIV = 0x18;
+
+    /* Fast ramp-up: 40 usec instead of 140 */
+    RADIO.MODECNF0 = BIT(RADIO_MODECNF0_RU);
+
+    /* Capture TIMER1 when the address is sent or received */
+    PPI.CH[RADIO_PPI].EEP = &RADIO.ADDRESS;
+    timer_capture(RADIO_PPI);
+    PPI.CHENSET = BIT(RADIO_PPI);
 }
 
-/* radio_await -- wait for expected interrupt */
-static void radio_await(unsigned volatile *event)
+/* rx_setup -- point the radio at the next free receive buffer */
+static void rx_setup(void)
 {
-    receive(INTERRUPT, NULL);
-    assert(*event);
-    *event = 0;
-    clear_pending(RADIO_IRQ);
-    enable_irq(RADIO_IRQ);
+    /* Keep the same buffer until a packet has been received in it */
+    if (rx_cur == NULL || rx_cur == &rx_spare)
+        rx_cur = (n_free > 0 ? rx_free[--n_free] : &rx_spare);
+
+    if (encrypting)
+        RADIO.PACKETPTR = rx_cipher[rx_ck].pkt;
+    else
+        RADIO.PACKETPTR = &rx_cur->length;
+    set_addresses();
+}
+
+/* rx_listen -- start listening from the disabled state */
+static void rx_listen(void)
+{
+    rx_setup();
+    RADIO.SHORTS = RX_SHORTS;
+    RADIO.RXEN = 1;
+}
+
+/* matches -- test if a packet is wanted by a subscriber */
+static int matches(struct sub *s, radio_buf *p)
+{
+    return (s->client != 0 && p->protocol == s->proto
+            && p->length-3 >= s->plen
+            && memcmp(p->data, s->prefix, s->plen) == 0);
+}
+
+/* dispatch -- add a packet to the queue of each subscriber that wants it */
+static void dispatch(radio_buf *p)
+{
+    int used = 0;
+
+    for (int i = 0; i < NSUB; i++) {
+        struct sub *s = &sub[i];
+        radio_buf *q = p;
+
+        if (! matches(s, p)) continue;
+
+        if (used) {
+            /* A second subscriber gets a copy */
+            if (s->count == NSUBQ || n_free == 0) {
+                stats.overruns++;
+                continue;
+            }
+            q = rx_free[--n_free];
+            memcpy(q, p, sizeof(radio_buf));
+        } else if (s->count == NSUBQ) {
+            stats.overruns++;
+            continue;
+        }
+
+        s->queue[(s->head + s->count) % NSUBQ] = q;
+        s->count++;
+        used = 1;
+    }
+
+    if (! used) {
+        /* Nobody took it: back to the pool */
+        rx_free[n_free++] = p;
+        stats.unclaimed++;
+    }
+}
+
+/* rx_packet -- deal with a packet that has just been received */
+static void rx_packet(void)
+{
+    if (RADIO.CRCSTATUS == 0)
+        stats.crc_errors++;
+    else if (encrypting) {
+        /* Decrypt it once the radio is listening again */
+        cipher_buf *c = &rx_cipher[rx_ck];
+        c->group = prefix[RADIO.RXMATCH];
+        c->rssi = -RADIO.RSSISAMPLE;
+        c->time = timer_captured();
+        rx_crypt = c;
+        rx_ck = 1 - rx_ck;
+    } else if (rx_cur->length < 3)
+        ;                       /* Malformed: ignore it */
+    else if (rx_cur == &rx_spare)
+        stats.overruns++;
+    else {
+        rx_cur->group = prefix[RADIO.RXMATCH];
+        rx_cur->rssi = -RADIO.RSSISAMPLE;
+        rx_cur->time = timer_captured();
+        stats.received++;
+        dispatch(rx_cur);
+        rx_cur = NULL;
+    }
+}
+
+/* ccm_mode -- value for CCM.MODE */
+static unsigned ccm_mode(int dir)
+{
+    int fast = (mode == RADIO_MODE_NRF_2Mbit || mode == RADIO_MODE_BLE_2Mbit);
+
+    return FIELD(CCM_MODE_MODE, dir)
+        | FIELD(CCM_MODE_DATARATE,
+                (fast ? CCM_DATARATE_2Mbit : CCM_DATARATE_1Mbit))
+        | FIELD(CCM_MODE_LENGTH, CCM_LENGTH_Extended);
+}
+
+/* rx_decrypt -- decrypt and check a received packet, if any */
+static void rx_decrypt(void)
+{
+    cipher_buf *c = rx_crypt;
+    byte *pkt;
+    radio_buf *p;
+    unsigned src, ctr;
+
+    if (c == NULL) return;
+    rx_crypt = NULL;
+
+    /* Check the lengths before letting the CCM loose on the packet:
+       pkt is length, version, group, protocol, src, ctr, H, L, RFU, ... */
+    pkt = c->pkt;
+    if (pkt[0] < 3+CCM_OVERHEAD || pkt[1] != CCM_VERSION
+        || pkt[11] != pkt[0] - 3 - CCM_CLEAR - 3) {
+        stats.auth_errors++;
+        return;
+    }
+
+    if (n_free == 0) {
+        stats.overruns++;
+        return;
+    }
+    p = rx_free[n_free-1];
+
+    ccm_get_header(&pkt[4], &src, &ctr);
+    ccm_nonce(&rx_cnf, src, ctr, c->group, pkt[3]);
+
+    /* The output is H, L, RFU, data, overlaying version, group,
+       protocol, data in the radio_buf */
+    CCM.MODE = ccm_mode(CCM_MODE_Decryption);
+    CCM.CNFPTR = &rx_cnf;
+    CCM.INPTR = &pkt[4+CCM_CLEAR];
+    CCM.OUTPTR = &p->version;
+    CCM.ENDCRYPT = 0;
+    CCM.ERROR = 0;
+    CCM.KSGEN = 1;
+    while (! CCM.ENDCRYPT && ! CCM.ERROR) { /* a few usec */ }
+
+    if (CCM.ERROR || CCM.MICSTATUS == 0) {
+        CCM.ERROR = 0;
+        stats.auth_errors++;
+        return;
+    }
+
+    if (! ccm_replay_check(&rx_replay, src, ctr)) {
+        stats.replays++;
+        return;
+    }
+
+    n_free--;
+    p->length = p->group + 3;
+    p->version = CCM_VERSION;
+    p->group = c->group;
+    p->protocol = pkt[3];
+    p->rssi = c->rssi;
+    p->time = c->time;
+    stats.received++;
+    dispatch(p);
+}
+
+/* deliver -- pass a packet to a waiting subscriber, if possible */
+static void deliver(struct sub *s)
+{
+    message m;
+    radio_buf *p;
+
+    if (! s->waiting || s->count == 0) return;
+
+    p = s->queue[s->head];
+    if (s->swap) {
+        /* Hand over the buffer and put the empty one in the pool */
+        rx_free[n_free++] = s->buf;
+        m.ptr1 = p;
+    } else {
+        m.int1 = p->length-3;
+        memcpy(s->buf, p->data, m.int1);
+        rx_free[n_free++] = p;
+    }
+    s->head = (s->head+1) % NSUBQ;
+    s->count--;
+    s->waiting = 0;
+
+    send(s->client, REPLY, &m);
+}
+
+/* deliver_all -- pass packets to any subscribers that are waiting */
+static void deliver_all(void)
+{
+    for (int i = 0; i < NSUB; i++)
+        deliver(&sub[i]);
+}
+
+/* find_sub -- find the subscription for a process, or make one */
+static struct sub *find_sub(int client, int create)
+{
+    struct sub *free = NULL;
+
+    for (int i = 0; i < NSUB; i++) {
+        if (sub[i].client == client) return &sub[i];
+        if (sub[i].client == 0 && free == NULL) free = &sub[i];
+    }
+
+    if (! create) return NULL;
+    if (free == NULL) panic("radio supports only %d listeners", NSUB);
+    free->client = client;
+    free->head = free->count = 0;
+    free->waiting = 0;
+    return free;
+}
+
+/* tx_shorts -- shortcuts for sending the packet at the queue head */
+static unsigned tx_shorts(void)
+{
+    unsigned shorts = BIT(RADIO_READY_START) | BIT(RADIO_END_DISABLE);
+
+    if (tx_count > 1)
+        shorts |= BIT(RADIO_DISABLED_TXEN);
+    else if (listening)
+        shorts |= BIT(RADIO_DISABLED_RXEN);
+
+    return shorts;
+}
+
+/* start_listening -- make sure the radio is listening */
+static void start_listening(void)
+{
+    if (listening) return;
+
+    listening = 1;
+    if (sending)
+        RADIO.SHORTS = tx_shorts();
+    else
+        rx_listen();
+}
+
+/* rx_stop -- disable the radio when it is not sending */
+static void rx_stop(void)
+{
+    if (RADIO.STATE == RADIO_STATE_Disabled) return;
+
+    RADIO.SHORTS = 0;
+    RADIO.DISABLE = 1;
+    while (! RADIO.DISABLED) { /* a few usec */ }
+    RADIO.DISABLED = 0;
+
+    /* Keep any packet that arrived just before */
+    if (RADIO.END) {
+        RADIO.END = 0;
+        rx_packet();
+        rx_decrypt();
+    }
+}
+
+/* tx_setup -- point the radio at the packet at the head of the queue */
+static void tx_setup(void)
+{
+    radio_buf *p = &tx_queue[tx_head];
+    byte *c = tx_cipher.pkt;
+    unsigned ctr;
+
+    if (! encrypting) {
+        RADIO.PACKETPTR = &p->length;
+        return;
+    }
+
+    if (! ccm_counter_next(&tx_ctr, &ctr))
+        panic("Radio has used up its counter: set a new key");
+
+    c[0] = p->length + CCM_OVERHEAD;
+    c[1] = CCM_VERSION;
+    c[2] = p->group;
+    c[3] = p->protocol;
+    ccm_put_header(&c[4], my_addr, ctr);
+    ccm_nonce(&tx_cnf, my_addr, ctr, p->group, p->protocol);
+
+    /* The CCM wants H, L, RFU in front of the data; PPI will start it
+       when the radio is ready */
+    p->version = 0;
+    p->group = p->length - 3;
+    p->protocol = 0;
+    CCM.MODE = ccm_mode(CCM_MODE_Encryption);
+    CCM.CNFPTR = &tx_cnf;
+    CCM.INPTR = &p->version;
+    CCM.OUTPTR = &c[4+CCM_CLEAR];
+    RADIO.PACKETPTR = c;
+}
+
+/* tx_kick -- start sending if there are packets and the radio is free */
+static void tx_kick(void)
+{
+    if (sending || tx_count == 0) return;
+
+    /* The radio may be set up for receiving */
+    rx_stop();
+
+    tx_setup();
+    set_addresses();
+    RADIO.SHORTS = tx_shorts();
+    sending = 1;
+    RADIO.TXEN = 1;
+}
+
+/* tx_accept -- copy a packet into the queue and reply or not */
+static void tx_accept(int client, void *buf, int n, int proto, int stamp)
+{
+    int i = (tx_head + tx_count) % NTX;
+    radio_buf *p = &tx_queue[i];
+
+    p->length = n+3;
+    p->version = 1;
+    p->group = group;
+    p->protocol = proto;
+    memcpy(p->data, buf, n);
+    tx_count++;
+
+    if (stamp)
+        /* Reply when the packet has been sent */
+        tx_notify[i] = client;
+    else {
+        tx_notify[i] = 0;
+        send(client, REPLY, NULL);
+    }
+
+    if (sending)
+        /* Let the packet in flight know there's another one */
+        RADIO.SHORTS = tx_shorts();
+    else
+        tx_kick();
+}
+
+/* random_word -- get 32 random bits from the RNG */
+static unsigned random_word(void)
+{
+    unsigned x = 0;
+
+    RNG.CONFIG = BIT(RNG_CONFIG_DERCEN);
+    RNG.START = 1;
+    for (int i = 0; i < 4; i++) {
+        while (! RNG.VALRDY) { /* about 30 usec */ }
+        RNG.VALRDY = 0;
+        x = (x << 8) | RNG.VALUE;
+    }
+    RNG.STOP = 1;
+    return x;
+}
+
+/* set_crypt -- apply the settings from radio_encrypt */
+static void set_crypt(void)
+{
+    unsigned dev;
+
+    encrypting = new_encrypt;
+
+    if (! encrypting) {
+        PPI.CHENCLR = BIT(CCM_PPI);
+        CCM.ENABLE = CCM_ENABLE_Disabled;
+        packet_format(RADIO_PACKET+3);
+        return;
+    }
+
+    /* Our address in the nonce is a 16-bit hash of the device ID */
+    dev = FICR.DEVICEID[0] ^ FICR.DEVICEID[1];
+    my_addr = (dev ^ (dev >> 16)) & 0xffff;
+
+    ccm_setkey(&tx_cnf, new_key);
+    ccm_setkey(&rx_cnf, new_key);
+    ccm_counter_init(&tx_ctr, random_word());
+    ccm_replay_init(&rx_replay);
+
+    CCM.ENABLE = CCM_ENABLE_Enabled;
+    CCM.SCRATCHPTR = ccm_scratch;
+    CCM.MAXPACKETSIZE = RADIO_PACKET+CCM_MIC;
+    CCM.SHORTS = BIT(CCM_ENDKSGEN_CRYPT);
+
+    PPI.CH[CCM_PPI].EEP = &RADIO.TXREADY;
+    PPI.CH[CCM_PPI].TEP = &CCM.KSGEN;
+    PPI.CHENSET = BIT(CCM_PPI);
+
+    packet_format(CIPHER_LEN);
+}
+
+/* reconfigure -- apply the settings from radio_config or radio_encrypt */
+static void reconfigure(void)
+{
+    rx_stop();
+
+    if (config_kind == RADIO_ENCRYPT)
+        set_crypt();
+    else if (config_kind == RADIO_ADDRS) {
+        change_group(addr_op, addr_group);
+        set_addresses();
+    } else {
+        mode = new_mode;
+        RADIO.MODE = mode;
+        RADIO.FREQUENCY = new_chan;
+        RADIO.TXPOWER = new_power & 0xff;
+        RADIO.PCNF0 = FIELD(RADIO_PCNF0_LFLEN, 8)
+            | FIELD(RADIO_PCNF0_PLEN,
+                    (mode == RADIO_MODE_NRF_2Mbit
+                     || mode == RADIO_MODE_BLE_2Mbit
+                     ? RADIO_PLEN_16bit : RADIO_PLEN_8bit));
+    }
+
+    send(config_client, REPLY, NULL);
+    config_client = 0;
+
+    if (listening) rx_listen();
+}
+
+/* tx_done -- deal with the end of a transmitted packet */
+static void tx_done(void)
+{
+    int state, notify;
+    unsigned time;
+    message m;
+
+    while (! RADIO.DISABLED) { /* a few usec */ }
+    RADIO.DISABLED = 0;
+    stats.sent++;
+
+    /* Note the time before the next packet's address is sent */
+    notify = tx_notify[tx_head];
+    time = timer_captured();
+
+    tx_head = (tx_head+1) % NTX;
+    tx_count--;
+
+    /* The radio is ramping up for whatever the shortcuts said */
+    state = RADIO.STATE;
+    if (state == RADIO_STATE_TxRu) {
+        /* The next packet is on its way */
+        tx_setup();
+        RADIO.SHORTS = tx_shorts();
+    } else {
+        sending = 0;
+        if (tx_count > 0)
+            /* Packets came too late for the shortcut */
+            tx_kick();
+        else if (config_client != 0)
+            /* Settings are waiting to be changed */
+            reconfigure();
+        else if (state == RADIO_STATE_RxRu) {
+            /* Going back to listening */
+            rx_setup();
+            RADIO.SHORTS = RX_SHORTS;
+        } else if (listening)
+            rx_listen();
+    }
+
+    if (notify != 0) {
+        m.int1 = time;
+        send(notify, REPLY, &m);
+    }
+
+    /* Let a waiting client into the queue */
+    if (n_wait > 0) {
+        tx_accept(waiting[wt_head].client, waiting[wt_head].buf,
+                  waiting[wt_head].n, waiting[wt_head].proto,
+                  waiting[wt_head].stamp);
+        wt_head = (wt_head+1) % NWAIT;
+        n_wait--;
+    }
+
+    /* Stopping the receiver may have queued a packet */
+    deliver_all();
 }
 
 /* radio_task -- device driver for radio */
 static void radio_task(int dummy)
 {
-    int mode = ASLEEP;
-    int listener = 0;
-    int n;
-    void *buffer = NULL;
+    struct sub *s;
     message m;
 
     init_radio();
+    running = 1;
+
+    for (int i = 0; i < NBUF; i++)
+        rx_free[n_free++] = &rx_pool[i];
 
     /* Configure interrupts */
-    RADIO.INTENSET =
-        BIT(RADIO_INT_READY) | BIT(RADIO_INT_END) | BIT(RADIO_INT_DISABLED);
+    RADIO.INTENSET = BIT(RADIO_INT_END);
     connect(RADIO_IRQ);
     enable_irq(RADIO_IRQ);
 
-    /* Set packet buffer */
-    RADIO.PACKETPTR = &packet_buffer;
-
     while (1) {
         receive(ANY, &m);
         switch (m.type) {
         case INTERRUPT:
-            /* A packet has been received */
-            if (!RADIO.END || mode != LISTENING)
-                panic("unexpected radio interrrupt");
-            RADIO.END = 0;
-            clear_pending(RADIO_IRQ);
-            enable_irq(RADIO_IRQ);
-
-            if (RADIO.CRCSTATUS == 0 || packet_buffer.group != group) {
-                /* Ignore the packet and listen again */
-                RADIO.START = 1;
-                break;
+            if (RADIO.END) {
+                RADIO.END = 0;
+                if (sending)
+                    tx_done();
+                else if (listening) {
+                    /* A packet has been received: listen again at once */
+                    rx_packet();
+                    rx_setup();
+                    RADIO.START = 1;
+                    rx_decrypt();
+                    deliver_all();
+                }
             }
 
-            n = packet_buffer.length-3;
-            memcpy(buffer, packet_buffer.data, n);
+            clear_pending(RADIO_IRQ);
+            enable_irq(RADIO_IRQ);
+            break;
 
-            m.int1 = n;
-            send(listener, REPLY, &m);
-            mode = AWAKE;
+        case RADIO_LISTEN:
+            s = find_sub(m.sender, 1);
+            s->proto = m.int1;
+            s->plen = m.int3;
+            memcpy(s->prefix, m.ptr2, s->plen);
+            start_listening();
+            send(m.sender, REPLY, NULL);
             break;
 
         case RECEIVE:
-            if (mode == LISTENING)
-                panic("radio supports only one listener at a time");
-            listener = m.sender;
-            buffer = m.ptr1;
-
-            if (mode == ASLEEP) {
-                RADIO.RXEN = 1;
-                radio_await(&RADIO.READY);
+            s = find_sub(m.sender, 0);
+            if (s == NULL) {
+                /* Subscribe to plain datagrams */
+                s = find_sub(m.sender, 1);
+                s->proto = RADIO_PROTO_DATAGRAM;
+                s->plen = 0;
             }
-
-            RADIO.PREFIX0 = group;
-            RADIO.START = 1;
-            mode = LISTENING;
+            s->waiting = 1;
+            s->buf = m.ptr1;
+            s->swap = m.int2;
+            start_listening();
+            deliver(s);
             break;
 
         case SEND:
-            if (mode != ASLEEP) {
-                /* The radio was set up for receiving: disable it */
-                RADIO.DISABLE = 1;
-                radio_await(&RADIO.DISABLED);
+            /* int3 has the protocol and a flag for a timestamp */
+            if (tx_count < NTX) {
+                tx_accept(m.sender, m.ptr1, m.int2,
+                          m.int3 >> 1, m.int3 & 1);
+                /* tx_kick may have stopped the receiver just after
+                   a packet arrived */
+                deliver_all();
+            } else {
+                /* Wait for space in the queue */
+                int i = (wt_head + n_wait) % NWAIT;
+                if (n_wait == NWAIT)
+                    panic("Too many processes waiting to send");
+                waiting[i].client = m.sender;
+                waiting[i].buf = m.ptr1;
+                waiting[i].n = m.int2;
+                waiting[i].proto = m.int3 >> 1;
+                waiting[i].stamp = m.int3 & 1;
+                n_wait++;
+            }
+            break;
+
+        case RADIO_CONFIG:
+            if (config_client != 0)
+                panic("radio is already being configured");
+            config_client = m.sender;
+            config_kind = RADIO_CONFIG;
+            new_mode = m.int1;
+            new_chan = m.int2;
+            new_power = m.int3;
+            if (! sending) {
+                reconfigure();
+                deliver_all();
             }
+            break;
 
-            /* Assemble the packet */
-            n = m.int2;
-            packet_buffer.length = n+3;
-            packet_buffer.version = 1;
-            packet_buffer.group = group;
-            packet_buffer.protocol = 1;
-            memcpy(packet_buffer.data, m.ptr1, n);
-
-            /* Enable for sending and transmit the packet */
-            RADIO.TXEN = 1;
-            radio_await(&RADIO.READY);
-            RADIO.PREFIX0 = group;
-            RADIO.START = 1;
-            radio_await(&RADIO.END);
-
-            /* Disable the transmitter -- otherwise it jams the airwaves */
-            RADIO.DISABLE = 1;
-            radio_await(&RADIO.DISABLED);
-
-            if (mode != LISTENING)
-                mode = ASLEEP;
-            else {
-                /* Go back to listening */
-                RADIO.RXEN = 1;
-                radio_await(&RADIO.READY);
-                RADIO.START = 1;
+        case RADIO_ENCRYPT:
+            if (config_client != 0)
+                panic("radio is already being configured");
+            config_client = m.sender;
+            config_kind = RADIO_ENCRYPT;
+            new_encrypt = (m.ptr1 != NULL);
+            if (new_encrypt) memcpy(new_key, m.ptr1, 16);
+            if (! sending) {
+                reconfigure();
+                deliver_all();
             }
+            break;
 
-            send(m.sender, REPLY, NULL);
+        case RADIO_ADDRS:
+            if (config_client != 0)
+                panic("radio is already being configured");
+            config_client = m.sender;
+            config_kind = RADIO_ADDRS;
+            addr_op = m.int1;
+            addr_group = m.int2;
+            if (! sending) {
+                reconfigure();
+                deliver_all();
+            }
             break;
 
         default:
@@ -172,19 +902,136 @@ static void radio_task(int dummy)
     }
 }
 
+/* change_addrs -- ask the driver to change the groups */
+static void change_addrs(int op, int grp)
+{
+    message m;
+
+    if (! running) {
+        /* Called from init: the driver will load the registers */
+        change_group(op, grp & 0xff);
+        return;
+    }
+
+    m.int1 = op;
+    m.int2 = grp & 0xff;
+    sendrec(RADIO_TASK, RADIO_ADDRS, &m);
+}
+
 /* radio_group -- set group id for radio messages */
 void radio_group(int grp)
 {
-    group = grp;
+    change_addrs(RADIO_ADDR_SET, grp);
+}
+
+/* radio_subscribe -- listen for messages in another group too */
+void radio_subscribe(int grp)
+{
+    change_addrs(RADIO_ADDR_ADD, grp);
+}
+
+/* radio_unsubscribe -- stop listening for messages in a group */
+void radio_unsubscribe(int grp)
+{
+    change_addrs(RADIO_ADDR_DROP, grp);
+}
+
+/* radio_config -- set data rate, channel (0..100) and power (dBm) */
+void radio_config(int mode, int chan, int power)
+{
+    message m;
+
+    switch (mode) {
+    case RADIO_MODE_NRF_1Mbit:
+    case RADIO_MODE_NRF_2Mbit:
+    case RADIO_MODE_BLE_1Mbit:
+    case RADIO_MODE_BLE_2Mbit:
+        break;
+    default:
+        panic("Radio mode %d is not supported", mode);
+    }
+
+    if (chan < 0 || chan > 100)
+        panic("Radio channel %d is not supported", chan);
+
+    switch (power) {
+    case 8: case 7: case 6: case 5: case 4: case 3: case 2: case 0:
+    case -4: case -8: case -12: case -16: case -20: case -40:
+        break;
+    default:
+        panic("Radio power %d dBm is not supported", power);
+    }
+
+    m.int1 = mode;
+    m.int2 = chan;
+    m.int3 = power;
+    sendrec(RADIO_TASK, RADIO_CONFIG, &m);
+}
+
+/* radio_airtime -- time on air in usec for a packet of n bytes */
+unsigned radio_airtime(int n)
+{
+    /* Preamble, 5 byte address, length, 3 byte prefix, data, 2 byte CRC,
+       and the extra bytes for encryption if it is in force */
+    int fast = (mode == RADIO_MODE_NRF_2Mbit || mode == RADIO_MODE_BLE_2Mbit);
+    int bytes = (fast ? 2 : 1) + 5 + 1 + 3 + n + 2
+        + (encrypting ? CCM_OVERHEAD : 0);
+    return (fast ? 4 * bytes : 8 * bytes);
+}
+
+/* radio_encrypt -- encrypt all packets with a 16-byte key, or stop
+   encrypting if key is NULL */
+void radio_encrypt(const void *key)
+{
+    message m;
+    m.ptr1 = (void *) key;
+    sendrec(RADIO_TASK, RADIO_ENCRYPT, &m);
 }
 
 /* radio_send -- send radio packet */
 void radio_send(void *buf, int n)
+{
+    radio_send_proto(RADIO_PROTO_DATAGRAM, buf, n);
+}
+
+/* radio_send_proto -- send radio packet with a protocol number */
+void radio_send_proto(int proto, void *buf, int n)
+{
+    message m;
+    m.ptr1 = buf;
+    m.int2 = n;
+    m.int3 = proto << 1;
+    sendrec(RADIO_TASK, SEND, &m);
+}
+
+/* radio_send_stamped -- send packet and return the time it was sent */
+unsigned radio_send_stamped(int proto, void *buf, int n)
 {
     message m;
     m.ptr1 = buf;
     m.int2 = n;
+    m.int3 = (proto << 1) | 1;
     sendrec(RADIO_TASK, SEND, &m);
+    return m.int1;
+}
+
+/* radio_listen -- receive packets with a protocol number and prefix */
+void radio_listen(int proto, const void *prefix, int n)
+{
+    /* Later calls of radio_receive or radio_receive_buf by this
+       process will get only packets with the given protocol whose
+       payload starts with the n bytes at prefix */
+    message m;
+
+    if (proto < 0 || proto > 127)
+        panic("Radio protocol %d is not supported", proto);
+    if (n < 0 || n > RADIO_MAXPREFIX)
+        panic("Radio prefix is too long");
+
+    m.int1 = proto;
+    m.ptr2 = (void *) prefix;
+    m.int3 = n;
+    sendrec(RADIO_TASK, RADIO_LISTEN, &m);
 }
 
 /* radio_receive -- receive radio packet and return length */
@@ -193,10 +1040,30 @@ int radio_receive(void *buf)
     /* buf must have space for RADIO_PACKET bytes */
     message m;
     m.ptr1 = buf;
+    m.int2 = 0;
     sendrec(RADIO_TASK, RECEIVE, &m);
     return m.int1;
 }
+
+/* radio_receive_buf -- exchange an empty buffer for a received packet */
+radio_buf *radio_receive_buf(radio_buf *empty)
+{
+    /* The driver keeps the empty buffer for a future packet */
+    message m;
+    m.ptr1 = empty;
+    m.int2 = 1;
+    sendrec(RADIO_TASK, RECEIVE, &m);
+    return m.ptr1;
+}
     
+/* radio_getstats -- fetch counts of packets and errors */
+void radio_getstats(struct radio_stats *st)
+{
+    /* Each counter is a single word, so it is safe to copy them
+       without asking the driver */
+    *st = stats;
+}
+
 /* radio_init -- start device driver */
 void radio_init(void)
 {
@@ -0,0 +1,337 @@
+/* reliable.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "reliable.h"
+#include <string.h>
+
+/* The protocol is selective repeat with cumulative ACKs.  Each data
+packet carries a 16-bit sequence number, and the sender may have up to
+window packets in flight.  The receiver answers every data packet
+with an ACK that gives the next sequence number it needs, together
+with a bitmap of the 32 packets after that which it has received out
+of order, so the sender need only repeat the packets that were really
+lost.  Packets are kept by the receiver until the client reads them,
+and a packet that is outside the receiver's window is refused, so a
+slow reader holds back the sender.
+
+Packets on the link look like this:
+
+    DATA: 'D', src, dst, seq (2 bytes), data ...
+    ACK:  'A', src, dst, ack (2 bytes), sack (4 bytes)
+
+with multi-byte fields little-endian.
+
+The retransmission timeout adapts to the measured round-trip time as
+in TCP: the smoothed RTT and its mean deviation are kept, and the
+timeout is SRTT + 4 RTTVAR.  No samples are taken from an ACK that
+covers a retransmitted packet, and each expiry of the timer doubles the
+timeout until an ACK makes progress.  Losses on the radio are not a
+sign of congestion, so the timeout is capped at REL_MAXRTO, which is
+much smaller than for TCP.  For that reason, an expiry resends only the
+oldest unacknowledged packet: resending the whole window could keep
+the link busy for longer than the timeout, and so would feed on itself.
+Without waiting for the timer, a packet is sent again once if the
+receiver has selectively acknowledged a later packet and a round trip
+has passed, and the oldest packet is sent again if three ACKs in a row
+make no progress.
+
+The host program x35-reliable/relsim tests the protocol against a
+simulated link that drops packets at random. */
+
+#define REL_DATA 'D'
+#define REL_ACK 'A'
+
+#define SLOT(seq) ((seq) & (REL_MAXWIN-1))
+
+/* before -- test if sequence number a comes before b */
+static int before(unsigned short a, unsigned short b)
+{
+    return (short) (a - b) < 0;
+}
+
+/* put16, put32, get16, get32 -- little-endian fields of a packet */
+static void put16(unsigned char *p, unsigned x)
+{
+    p[0] = x & 0xff; p[1] = (x >> 8) & 0xff;
+}
+
+static void put32(unsigned char *p, unsigned x)
+{
+    put16(p, x); put16(p+2, x >> 16);
+}
+
+static unsigned get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned get32(const unsigned char *p)
+{
+    return get16(p) | (get16(p+2) << 16);
+}
+
+/* rel_init -- initialise a connection */
+void rel_init(rel_conn *c, int self, int peer, int window,
+              void (*output)(rel_conn *c, const unsigned char *pkt, int n))
+{
+    memset(c, 0, sizeof(rel_conn));
+    if (window < 1) window = 1;
+    if (window > REL_MAXWIN) window = REL_MAXWIN;
+    c->self = self;
+    c->peer = peer;
+    c->window = window;
+    c->output = output;
+    c->rto = REL_INITRTO;
+}
+
+/* rel_space -- number of packets that can be sent now */
+int rel_space(rel_conn *c)
+{
+    return c->window - (unsigned short) (c->snd_nxt - c->snd_una);
+}
+
+/* rel_pending -- number of packets not yet acknowledged */
+int rel_pending(rel_conn *c)
+{
+    return (unsigned short) (c->snd_nxt - c->snd_una);
+}
+
+/* transmit -- send or resend a data packet */
+static void transmit(rel_conn *c, unsigned short seq, unsigned now)
+{
+    unsigned char pkt[REL_HEADER+REL_MAXDATA];
+    int n = c->tx[SLOT(seq)].len;
+
+    pkt[0] = REL_DATA;
+    pkt[1] = c->self;
+    pkt[2] = c->peer;
+    put16(&pkt[3], seq);
+    memcpy(&pkt[REL_HEADER], c->tx[SLOT(seq)].data, n);
+    c->tx[SLOT(seq)].sent_at = now;
+    (*c->output)(c, pkt, REL_HEADER+n);
+}
+
+/* rel_send -- send a datagram if the window allows; return 1 if sent */
+int rel_send(rel_conn *c, const void *buf, int n, unsigned now)
+{
+    unsigned short seq = c->snd_nxt;
+
+    if (rel_space(c) <= 0) return 0;
+    if (n > REL_MAXDATA) n = REL_MAXDATA;
+
+    c->tx[SLOT(seq)].acked = 0;
+    c->tx[SLOT(seq)].resent = 0;
+    c->tx[SLOT(seq)].len = n;
+    memcpy(c->tx[SLOT(seq)].data, buf, n);
+    c->snd_nxt++;
+    c->stats.sent++;
+    transmit(c, seq, now);
+    return 1;
+}
+
+/* resend -- retransmit a packet */
+static void resend(rel_conn *c, unsigned short seq, unsigned now)
+{
+    c->tx[SLOT(seq)].resent = 1;
+    c->stats.resent++;
+    transmit(c, seq, now);
+}
+
+/* set_rto -- compute the timeout from the RTT estimates */
+static void set_rto(rel_conn *c)
+{
+    unsigned rto = (c->srtt >> 3) + c->rttvar;
+    if (rto < REL_MINRTO) rto = REL_MINRTO;
+    if (rto > REL_MAXRTO) rto = REL_MAXRTO;
+    c->rto = rto;
+}
+
+/* rtt_sample -- update the RTT estimates with a new measurement */
+static void rtt_sample(rel_conn *c, unsigned r)
+{
+    if (c->srtt == 0) {
+        c->srtt = r << 3;
+        c->rttvar = r << 1;
+    } else {
+        int delta = r - (c->srtt >> 3);
+        c->srtt += delta;
+        if (delta < 0) delta = -delta;
+        c->rttvar += delta - (c->rttvar >> 2);
+    }
+
+    set_rto(c);
+}
+
+/* send_ack -- tell the sender what has arrived */
+static void send_ack(rel_conn *c)
+{
+    unsigned char pkt[REL_ACKLEN];
+    unsigned sack = 0;
+
+    for (int i = 0; i < 32; i++) {
+        unsigned short seq = c->rcv_nxt + 1 + i;
+        if (! before(seq, c->rcv_read + c->window)) break;
+        if (c->rx[SLOT(seq)].present) sack |= 1 << i;
+    }
+
+    pkt[0] = REL_ACK;
+    pkt[1] = c->self;
+    pkt[2] = c->peer;
+    put16(&pkt[3], c->rcv_nxt);
+    put32(&pkt[5], sack);
+    (*c->output)(c, pkt, REL_ACKLEN);
+}
+
+/* advance -- move rcv_nxt past packets that have arrived */
+static void advance(rel_conn *c)
+{
+    while (before(c->rcv_nxt, c->rcv_read + c->window)
+           && c->rx[SLOT(c->rcv_nxt)].present)
+        c->rcv_nxt++;
+}
+
+/* data_input -- deal with an incoming data packet */
+static void data_input(rel_conn *c, const unsigned char *pkt, int n)
+{
+    unsigned short seq = get16(&pkt[3]);
+    int len = n - REL_HEADER;
+
+    if (len < 0 || len > REL_MAXDATA)
+        return;
+
+    if (before(seq, c->rcv_nxt))
+        /* Seen it before: perhaps our ACK was lost */
+        c->stats.dups++;
+    else if (! before(seq, c->rcv_read + c->window))
+        /* No room until the client reads some data */
+        c->full = 1;
+    else if (c->rx[SLOT(seq)].present)
+        c->stats.dups++;
+    else {
+        c->rx[SLOT(seq)].present = 1;
+        c->rx[SLOT(seq)].len = len;
+        memcpy(c->rx[SLOT(seq)].data, &pkt[REL_HEADER], len);
+        advance(c);
+    }
+
+    send_ack(c);
+}
+
+/* ack_input -- deal with an incoming ACK */
+static void ack_input(rel_conn *c, const unsigned char *pkt, int n,
+                      unsigned now)
+{
+    unsigned short ack, seq;
+    unsigned sack;
+    int sample = -1;
+
+    if (n < REL_ACKLEN) return;
+    ack = get16(&pkt[3]);
+    sack = get32(&pkt[5]);
+
+    /* Ignore ACKs that are old or for packets not yet sent */
+    if (before(ack, c->snd_una) || before(c->snd_nxt, ack)) return;
+    c->stats.acks++;
+
+    if (ack == c->snd_una) {
+        if (c->snd_una != c->snd_nxt && ++c->dupacks == 3)
+            /* Fast retransmit */
+            resend(c, c->snd_una, now);
+    } else {
+        /* Progress: take an RTT sample from the newest packet acked
+           that was sent only once.  If any of the packets was resent,
+           the ACK may have been prompted by the copy, so no sample. */
+        for (seq = c->snd_una; seq != ack; seq++) {
+            if (c->tx[SLOT(seq)].resent) {
+                sample = -1;
+                break;
+            }
+            if (! c->tx[SLOT(seq)].acked)
+                sample = now - c->tx[SLOT(seq)].sent_at;
+        }
+        c->snd_una = ack;
+        c->dupacks = 0;
+        if (sample >= 0)
+            rtt_sample(c, sample);
+        else
+            set_rto(c);         /* Undo any backoff */
+    }
+
+    /* Note packets received out of order */
+    unsigned short high = ack;
+    for (int i = 0; i < 32; i++) {
+        seq = ack + 1 + i;
+        if (! before(seq, c->snd_nxt)) break;
+        if (sack & (1 << i)) {
+            c->tx[SLOT(seq)].acked = 1;
+            high = seq;
+        }
+    }
+
+    /* Packets before the last one received that were sent more than
+       a round trip ago must have been lost.  Each is resent this way
+       only once, so that a burst of ACKs cannot make a burst of
+       copies; if the copy is lost too, the timer deals with it. */
+    for (seq = ack; before(seq, high); seq++) {
+        if (! c->tx[SLOT(seq)].acked && ! c->tx[SLOT(seq)].resent
+            && now - c->tx[SLOT(seq)].sent_at > (c->srtt >> 3))
+            resend(c, seq, now);
+    }
+}
+
+/* rel_input -- process a packet from the link */
+void rel_input(rel_conn *c, const unsigned char *pkt, int n, unsigned now)
+{
+    /* Ignore packets for other connections */
+    if (n < REL_HEADER || pkt[1] != c->peer || pkt[2] != c->self)
+        return;
+
+    switch (pkt[0]) {
+    case REL_DATA:
+        data_input(c, pkt, n);
+        break;
+    case REL_ACK:
+        ack_input(c, pkt, n, now);
+        break;
+    }
+}
+
+/* rel_recv -- fetch the next datagram in order, or return -1 */
+int rel_recv(rel_conn *c, void *buf)
+{
+    int n;
+
+    if (c->rcv_read == c->rcv_nxt) return -1;
+
+    n = c->rx[SLOT(c->rcv_read)].len;
+    memcpy(buf, c->rx[SLOT(c->rcv_read)].data, n);
+    c->rx[SLOT(c->rcv_read)].present = 0;
+    c->rcv_read++;
+    c->stats.delivered++;
+    advance(c);
+
+    if (c->full) {
+        /* Let the sender know there is room again */
+        c->full = 0;
+        send_ack(c);
+    }
+
+    return n;
+}
+
+/* rel_tick -- retransmit the oldest packet if its timer has expired */
+void rel_tick(rel_conn *c, unsigned now)
+{
+    /* Only the packet at snd_una is sent again: its ACK will report any
+       later losses, and they are repaired from the SACK bitmap */
+    if (c->snd_una == c->snd_nxt
+        || now - c->tx[SLOT(c->snd_una)].sent_at < c->rto)
+        return;
+
+    resend(c, c->snd_una, now);
+
+    /* Back off */
+    c->stats.timeouts++;
+    c->rto = 2 * c->rto;
+    if (c->rto > REL_MAXRTO) c->rto = REL_MAXRTO;
+}
@@ -0,0 +1,71 @@
+/* reliable.h */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Reliable, in-order delivery of datagrams over a lossy link such as
+the radio.  The protocol state machine in reliable.c depends on nothing
+in microbian, so that it can be tested on a host computer against a
+simulated link; the process in rlink.c connects it to the radio. */
+
+#define REL_MAXWIN 16           /* Max window: a power of two */
+#define REL_MAXDATA 120         /* Max bytes of data per packet */
+#define REL_HEADER 5            /* Bytes of header on a data packet */
+#define REL_ACKLEN 9            /* Bytes in an ACK packet */
+
+#define REL_MINRTO 2000         /* Bounds on retransmission timeout (usec) */
+#define REL_MAXRTO 40000
+#define REL_INITRTO 20000       /* Timeout before first RTT sample */
+
+/* rel_stats -- counts of events on a connection */
+struct rel_stats {
+    unsigned sent;              /* Data packets sent for the first time */
+    unsigned resent;            /* Retransmissions */
+    unsigned timeouts;          /* Occasions when the timer expired */
+    unsigned acks;              /* ACK packets received */
+    unsigned dups;              /* Duplicate data packets received */
+    unsigned delivered;         /* Datagrams passed to the client */
+};
+
+/* rel_conn -- state of one end of a connection */
+typedef struct rel_conn {
+    int self, peer;             /* Addresses of this end and the other */
+    int window;                 /* Window size, at most REL_MAXWIN */
+    void (*output)(struct rel_conn *c, const unsigned char *pkt, int n);
+                                /* Function to put a packet on the link */
+    void *user;                 /* For use by the client */
+
+    /* Sender: packets snd_una .. snd_nxt-1 are awaiting an ACK */
+    unsigned short snd_una, snd_nxt;
+    int dupacks;                /* ACKs in a row without progress */
+    unsigned srtt, rttvar;      /* Smoothed RTT x 8, variance x 4 (usec) */
+    unsigned rto;               /* Retransmission timeout (usec) */
+    struct {
+        unsigned char acked;    /* Whether ACK'ed (perhaps selectively) */
+        unsigned char resent;   /* Whether retransmitted (no RTT sample) */
+        unsigned char len;      /* Length of data */
+        unsigned sent_at;       /* Time of last transmission */
+        unsigned char data[REL_MAXDATA];
+    } tx[REL_MAXWIN];
+
+    /* Receiver: rcv_read .. rcv_nxt-1 are waiting to be read, and
+       later packets may have arrived out of order */
+    unsigned short rcv_read, rcv_nxt;
+    int full;                   /* Whether a packet was refused for space */
+    struct {
+        unsigned char present;  /* Whether the packet has arrived */
+        unsigned char len;      /* Length of data */
+        unsigned char data[REL_MAXDATA];
+    } rx[REL_MAXWIN];
+
+    struct rel_stats stats;
+} rel_conn;
+
+/* Times passed as now are in microseconds, and may wrap around */
+
+void rel_init(rel_conn *c, int self, int peer, int window,
+              void (*output)(rel_conn *c, const unsigned char *pkt, int n));
+int rel_space(rel_conn *c);
+int rel_pending(rel_conn *c);
+int rel_send(rel_conn *c, const void *buf, int n, unsigned now);
+int rel_recv(rel_conn *c, void *buf);
+void rel_input(rel_conn *c, const unsigned char *pkt, int n, unsigned now);
+void rel_tick(rel_conn *c, unsigned now);
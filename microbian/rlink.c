@@ -0,0 +1,136 @@
+/* rlink.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "reliable.h"
+
+/* A reliable link to another micro:bit, using the protocol in
+reliable.c over the radio.  The RLink process owns the connection
+state: clients call rlink_send and rlink_receive, and a helper process
+RLinkRx waits for radio packets and passes them to RLink.  Regular
+timer pulses let the protocol retransmit lost packets.  rlink_send
+returns as soon as the packet is in the window, and blocks while the
+window is full.  The link's packets have their own protocol number,
+so a program that uses rlink can still use the radio for other
+things. */
+
+static int RLINK_TASK;
+
+#define TICK 1                  /* Interval between timer pulses (ms) */
+
+#define RLINK_PACKET 16         /* Message type for packet from RLinkRx */
+
+static rel_conn conn;
+
+/* output -- send a packet by radio */
+static void output(rel_conn *c, const unsigned char *pkt, int n)
+{
+    radio_send_proto(RADIO_PROTO_RLINK, (void *) pkt, n);
+}
+
+/* rlink_rx_task -- pass packets from the radio to RLink */
+static void rlink_rx_task(int dummy)
+{
+    static radio_buf spare;
+    radio_buf *p = &spare;
+    message m;
+
+    radio_listen(RADIO_PROTO_RLINK, NULL, 0);
+
+    while (1) {
+        p = radio_receive_buf(p);
+        m.ptr1 = p;
+        sendrec(RLINK_TASK, RLINK_PACKET, &m);
+    }
+}
+
+/* rlink_task -- process that runs the protocol */
+static void rlink_task(int arg)
+{
+    int sender = 0, receiver = 0, n;
+    void *sbuf = NULL, *rbuf = NULL;
+    int slen = 0;
+    message m;
+
+    timer_pulse(TICK);
+
+    while (1) {
+        receive(ANY, &m);
+        switch (m.type) {
+        case PING:
+            rel_tick(&conn, timer_micros());
+            break;
+
+        case RLINK_PACKET: {
+            radio_buf *p = m.ptr1;
+            rel_input(&conn, p->data, p->length-3, timer_micros());
+            send(m.sender, REPLY, NULL);
+            break;
+        }
+
+        case SEND:
+            if (sender != 0)
+                panic("rlink supports only one sender at a time");
+            sender = m.sender;
+            sbuf = m.ptr1;
+            slen = m.int2;
+            break;
+
+        case RECEIVE:
+            if (receiver != 0)
+                panic("rlink supports only one receiver at a time");
+            receiver = m.sender;
+            rbuf = m.ptr1;
+            break;
+
+        default:
+            badmesg(m.type);
+        }
+
+        /* See if a waiting client can go ahead */
+        if (sender != 0 && rel_send(&conn, sbuf, slen, timer_micros())) {
+            send(sender, REPLY, NULL);
+            sender = 0;
+        }
+
+        if (receiver != 0 && (n = rel_recv(&conn, rbuf)) >= 0) {
+            m.int1 = n;
+            send(receiver, REPLY, &m);
+            receiver = 0;
+        }
+    }
+}
+
+/* rlink_send -- send a datagram of at most REL_MAXDATA bytes */
+void rlink_send(void *buf, int n)
+{
+    message m;
+    m.ptr1 = buf;
+    m.int2 = n;
+    sendrec(RLINK_TASK, SEND, &m);
+}
+
+/* rlink_receive -- receive the next datagram and return its length */
+int rlink_receive(void *buf)
+{
+    /* buf must have space for REL_MAXDATA bytes */
+    message m;
+    m.ptr1 = buf;
+    sendrec(RLINK_TASK, RECEIVE, &m);
+    return m.int1;
+}
+
+/* rlink_getstats -- fetch counts of protocol events */
+void rlink_getstats(struct rel_stats *st)
+{
+    *st = conn.stats;
+}
+
+/* rlink_init -- start the link between self and peer */
+void rlink_init(int self, int peer, int window)
+{
+    rel_init(&conn, self, peer, window, output);
+    RLINK_TASK = start("RLink", rlink_task, 0, 512);
+    start("RLinkRx", rlink_rx_task, 0, 256);
+}
@@ -0,0 +1,235 @@
+/* scroll.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include <string.h>
+
+/* Scrolling text on the LED display.  A process Scroller moves the
+text one column to the left every few display frames, taking the new
+right-hand column from the font and shifting the image in place with
+image_shift, so no image is ever rebuilt from scratch.  It wakes at
+frame boundaries using display_notify, and can also accept new text at
+any time; the new text replaces the old.  The display wakes every
+process that asks, so other processes can use display_vsync while text
+is scrolling, but their calls to display_show will be overwritten at
+the next step. */
+
+static int SCROLL_TASK;
+
+#define SCROLL_TEXT 16          /* Message type for new text */
+
+#define MAXTEXT 64              /* Longest text that can be scrolled */
+
+/* The font has a glyph for each printable ASCII character.  Each glyph
+is a list of five columns, with bit 0 for the top row.  Glyphs are
+pushed to the left, and the width of each is given by its last
+non-empty column; a blank column is put between characters. */
+
+#define FIRST 32                /* Code of first glyph */
+#define NGLYPHS 95              /* Number of glyphs */
+#define SPACE_WIDTH 2           /* Width of a space */
+#define TAIL 4                  /* Blank columns after the text */
+
+/* font -- column bitmaps for ASCII characters */
+static const byte font[NGLYPHS][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 },  /* ' ' */
+    { 0x17, 0x00, 0x00, 0x00, 0x00 },  /* '!' */
+    { 0x03, 0x00, 0x03, 0x00, 0x00 },  /* '"' */
+    { 0x0a, 0x1f, 0x0a, 0x1f, 0x0a },  /* '#' */
+    { 0x02, 0x17, 0x1d, 0x1d, 0x00 },  /* '$' */
+    { 0x13, 0x09, 0x04, 0x12, 0x19 },  /* '%' */
+    { 0x0a, 0x15, 0x15, 0x0a, 0x10 },  /* '&' */
+    { 0x03, 0x00, 0x00, 0x00, 0x00 },  /* ''' */
+    { 0x0e, 0x11, 0x00, 0x00, 0x00 },  /* '(' */
+    { 0x11, 0x0e, 0x00, 0x00, 0x00 },  /* ')' */
+    { 0x0a, 0x04, 0x0a, 0x00, 0x00 },  /* '*' */
+    { 0x04, 0x0e, 0x04, 0x00, 0x00 },  /* '+' */
+    { 0x10, 0x08, 0x00, 0x00, 0x00 },  /* ',' */
+    { 0x04, 0x04, 0x04, 0x00, 0x00 },  /* '-' */
+    { 0x10, 0x00, 0x00, 0x00, 0x00 },  /* '.' */
+    { 0x10, 0x08, 0x04, 0x02, 0x01 },  /* '/' */
+    { 0x0e, 0x11, 0x11, 0x0e, 0x00 },  /* '0' */
+    { 0x12, 0x1f, 0x10, 0x00, 0x00 },  /* '1' */
+    { 0x19, 0x15, 0x15, 0x12, 0x00 },  /* '2' */
+    { 0x09, 0x11, 0x15, 0x0b, 0x00 },  /* '3' */
+    { 0x0c, 0x0a, 0x09, 0x1f, 0x00 },  /* '4' */
+    { 0x17, 0x15, 0x15, 0x09, 0x00 },  /* '5' */
+    { 0x0c, 0x16, 0x15, 0x08, 0x00 },  /* '6' */
+    { 0x11, 0x09, 0x05, 0x03, 0x00 },  /* '7' */
+    { 0x0a, 0x15, 0x15, 0x0a, 0x00 },  /* '8' */
+    { 0x02, 0x15, 0x0d, 0x07, 0x00 },  /* '9' */
+    { 0x0a, 0x00, 0x00, 0x00, 0x00 },  /* ':' */
+    { 0x10, 0x0a, 0x00, 0x00, 0x00 },  /* ';' */
+    { 0x04, 0x0a, 0x11, 0x00, 0x00 },  /* '<' */
+    { 0x0a, 0x0a, 0x0a, 0x00, 0x00 },  /* '=' */
+    { 0x11, 0x0a, 0x04, 0x00, 0x00 },  /* '>' */
+    { 0x02, 0x01, 0x15, 0x02, 0x00 },  /* '?' */
+    { 0x0e, 0x11, 0x0d, 0x09, 0x06 },  /* '@' */
+    { 0x1e, 0x05, 0x05, 0x1e, 0x00 },  /* 'A' */
+    { 0x1f, 0x15, 0x15, 0x0a, 0x00 },  /* 'B' */
+    { 0x0e, 0x11, 0x11, 0x11, 0x00 },  /* 'C' */
+    { 0x1f, 0x11, 0x11, 0x0e, 0x00 },  /* 'D' */
+    { 0x1f, 0x15, 0x15, 0x11, 0x00 },  /* 'E' */
+    { 0x1f, 0x05, 0x05, 0x01, 0x00 },  /* 'F' */
+    { 0x0e, 0x11, 0x11, 0x15, 0x0c },  /* 'G' */
+    { 0x1f, 0x04, 0x04, 0x1f, 0x00 },  /* 'H' */
+    { 0x11, 0x1f, 0x11, 0x00, 0x00 },  /* 'I' */
+    { 0x09, 0x11, 0x11, 0x0f, 0x01 },  /* 'J' */
+    { 0x1f, 0x04, 0x0a, 0x11, 0x00 },  /* 'K' */
+    { 0x1f, 0x10, 0x10, 0x10, 0x00 },  /* 'L' */
+    { 0x1f, 0x02, 0x04, 0x02, 0x1f },  /* 'M' */
+    { 0x1f, 0x02, 0x04, 0x08, 0x1f },  /* 'N' */
+    { 0x0e, 0x11, 0x11, 0x0e, 0x00 },  /* 'O' */
+    { 0x1f, 0x05, 0x05, 0x02, 0x00 },  /* 'P' */
+    { 0x06, 0x09, 0x09, 0x16, 0x10 },  /* 'Q' */
+    { 0x1f, 0x05, 0x0d, 0x12, 0x00 },  /* 'R' */
+    { 0x12, 0x15, 0x15, 0x09, 0x00 },  /* 'S' */
+    { 0x01, 0x01, 0x1f, 0x01, 0x01 },  /* 'T' */
+    { 0x0f, 0x10, 0x10, 0x0f, 0x00 },  /* 'U' */
+    { 0x07, 0x08, 0x10, 0x08, 0x07 },  /* 'V' */
+    { 0x1f, 0x08, 0x04, 0x08, 0x1f },  /* 'W' */
+    { 0x1b, 0x04, 0x04, 0x1b, 0x00 },  /* 'X' */
+    { 0x01, 0x02, 0x1c, 0x02, 0x01 },  /* 'Y' */
+    { 0x19, 0x15, 0x13, 0x11, 0x00 },  /* 'Z' */
+    { 0x1f, 0x11, 0x11, 0x00, 0x00 },  /* '[' */
+    { 0x01, 0x02, 0x04, 0x08, 0x10 },  /* '\' */
+    { 0x11, 0x11, 0x1f, 0x00, 0x00 },  /* ']' */
+    { 0x02, 0x01, 0x02, 0x00, 0x00 },  /* '^' */
+    { 0x10, 0x10, 0x10, 0x10, 0x00 },  /* '_' */
+    { 0x01, 0x02, 0x00, 0x00, 0x00 },  /* '`' */
+    { 0x0c, 0x12, 0x12, 0x1e, 0x00 },  /* 'a' */
+    { 0x1f, 0x12, 0x12, 0x0c, 0x00 },  /* 'b' */
+    { 0x0c, 0x12, 0x12, 0x12, 0x00 },  /* 'c' */
+    { 0x0c, 0x12, 0x12, 0x1f, 0x00 },  /* 'd' */
+    { 0x0e, 0x15, 0x15, 0x16, 0x00 },  /* 'e' */
+    { 0x04, 0x1e, 0x05, 0x01, 0x00 },  /* 'f' */
+    { 0x02, 0x15, 0x15, 0x0f, 0x00 },  /* 'g' */
+    { 0x1f, 0x04, 0x04, 0x18, 0x00 },  /* 'h' */
+    { 0x1d, 0x00, 0x00, 0x00, 0x00 },  /* 'i' */
+    { 0x10, 0x0d, 0x00, 0x00, 0x00 },  /* 'j' */
+    { 0x1f, 0x04, 0x0a, 0x10, 0x00 },  /* 'k' */
+    { 0x0f, 0x10, 0x00, 0x00, 0x00 },  /* 'l' */
+    { 0x1e, 0x02, 0x0c, 0x02, 0x1c },  /* 'm' */
+    { 0x1e, 0x02, 0x02, 0x1c, 0x00 },  /* 'n' */
+    { 0x0c, 0x12, 0x12, 0x0c, 0x00 },  /* 'o' */
+    { 0x1e, 0x0a, 0x0a, 0x04, 0x00 },  /* 'p' */
+    { 0x04, 0x0a, 0x0a, 0x1e, 0x00 },  /* 'q' */
+    { 0x1c, 0x02, 0x02, 0x00, 0x00 },  /* 'r' */
+    { 0x14, 0x12, 0x0a, 0x00, 0x00 },  /* 's' */
+    { 0x02, 0x0f, 0x12, 0x00, 0x00 },  /* 't' */
+    { 0x0e, 0x10, 0x10, 0x1e, 0x00 },  /* 'u' */
+    { 0x06, 0x08, 0x10, 0x08, 0x06 },  /* 'v' */
+    { 0x0e, 0x10, 0x0c, 0x10, 0x0e },  /* 'w' */
+    { 0x12, 0x0c, 0x0c, 0x12, 0x00 },  /* 'x' */
+    { 0x02, 0x14, 0x14, 0x0e, 0x00 },  /* 'y' */
+    { 0x12, 0x1a, 0x16, 0x12, 0x00 },  /* 'z' */
+    { 0x04, 0x1f, 0x11, 0x00, 0x00 },  /* '{' */
+    { 0x1f, 0x00, 0x00, 0x00, 0x00 },  /* '|' */
+    { 0x11, 0x1b, 0x04, 0x04, 0x00 },  /* '}' */
+    { 0x04, 0x02, 0x04, 0x08, 0x04 },  /* '~' */
+};
+
+/* glyph -- find the glyph for a character */
+static const byte *glyph(char ch)
+{
+    if (ch < FIRST || ch >= FIRST+NGLYPHS) ch = '?';
+    return font[ch - FIRST];
+}
+
+/* glyph_width -- number of columns in a glyph */
+static int glyph_width(char ch)
+{
+    const byte *g = glyph(ch);
+    int w = 5;
+
+    if (ch == ' ') return SPACE_WIDTH;
+    while (w > 0 && g[w-1] == 0) w--;
+    return w;
+}
+
+static char text[MAXTEXT+1];    /* Text being scrolled */
+static const char *cur;         /* Current character */
+static int col;                 /* Next column of current character */
+static int tail;                /* Blank columns still to come at end */
+
+/* next_column -- fetch the next column of the text, or -1 at the end */
+static int next_column(void)
+{
+    if (*cur == '\0')
+        return (tail-- > 0 ? 0 : -1);
+
+    if (col < glyph_width(*cur))
+        return glyph(*cur)[col++];
+
+    /* Gap between characters */
+    cur++; col = 0;
+    return 0;
+}
+
+/* scroll_task -- process that scrolls text */
+static void scroll_task(int dummy)
+{
+    int busy = 0, waiting = 0, frames = 0, nframes = 1, c;
+    image img;
+    message m;
+
+    while (1) {
+        if (busy && ! waiting) {
+            display_notify();
+            waiting = 1;
+        }
+
+        receive(ANY, &m);
+        switch (m.type) {
+        case INTERRUPT:
+            /* A frame boundary */
+            waiting = 0;
+            if (! busy || --frames > 0) break;
+
+            c = next_column();
+            if (c < 0) {
+                busy = 0;
+                break;
+            }
+
+            image_shift(img, c);
+            display_show(img);
+            frames = nframes;
+            break;
+
+        case SCROLL_TEXT:
+            strncpy(text, m.ptr1, MAXTEXT);
+            text[MAXTEXT] = '\0';
+            nframes = (m.int2 + DISPLAY_FRAME/2) / DISPLAY_FRAME;
+            if (nframes < 1) nframes = 1;
+            send(m.sender, REPLY, NULL);
+
+            cur = text; col = 0; tail = TAIL;
+            image_clear(img);
+            busy = 1; frames = 1;
+            break;
+
+        default:
+            badmesg(m.type);
+        }
+    }
+}
+
+/* display_scroll -- start scrolling a string across the display,
+   moving one column every ms_per_col milliseconds */
+void display_scroll(const char *str, int ms_per_col)
+{
+    /* Only the first MAXTEXT characters are used.  The call returns
+       at once, and the text is copied so the caller can reuse it. */
+    message m;
+    m.ptr1 = (void *) str;
+    m.int2 = ms_per_col;
+    sendrec(SCROLL_TASK, SCROLL_TEXT, &m);
+}
+
+/* scroll_init -- start the scroller process */
+void scroll_init(void)
+{
+    SCROLL_TASK = start("Scroller", scroll_task, 0, 256);
+}
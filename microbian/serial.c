@@ -13,12 +13,38 @@ static int SERIAL_TASK;
 #define PUTC 16
 #define GETC 17
 #define PUTBUF 18
+#define GETLINE 19
 
 /* There are two buffers, one for characters waiting to be output, and
 another for input characters waiting to be read by other processes.
 The input buffer has |n_edit| characters in the current line, still
 subject to editing, and |n_avail| characters in previous lines that
-are available to other processes. */
+are available to other processes.  In raw mode, used by serial_read(),
+each character is available at once, with no echo or editing.
+
+Processes waiting for input form a queue, and are served in order.
+A request from serial_getc() or serial_readline() puts the driver in
+line-editing mode, and a request from serial_read() puts it in raw
+mode; the mode then stays the same until another kind of request
+reaches the front of the queue.
+
+Output requests that arrive while the output buffer is busy are not
+copied into it character by character.  Instead, each request joins a
+queue of writers, and as much as fits is copied in one go.  Anything
+left over is transmitted directly from the client's own buffer once
+the output buffer has drained, and the client gets its reply when the
+last character has been handed to the UART.  That's safe because a
+client that sends PUTBUF or WRITE with sendrec() can't touch the
+buffer until it gets the reply.  Every client, including one that
+calls serial_putc, waits for a reply, so each process has at most one
+writer in the queue, and the driver never has to wait for space.
+
+Time limits for serial_read are kept with a single one-shot alarm for
+the earliest deadline, set and cancelled with timer_alarm and
+timer_cancel, which don't send messages to the timer task.  The driver
+never blocks except in its main receive() or when replying to a
+client that is waiting for the reply, so the timer task can always
+deliver the alarm at once. */
 
 /* NBUF -- size of input and output buffers.  Should be a power of 2. */
 #define NBUF 256
@@ -39,7 +65,38 @@ static int tx_inp = 0;          /* In pointer */
 static int tx_outp = 0;         /* Out pointer */
 static int n_tx = 0;            /* Character count */
 
-static int reader = -1;         /* Process waiting to read */
+/* NWRITE -- max number of queued output requests */
+#define NWRITE 16
+
+/* Queue of output requests */
+static struct writer {
+    int client;                 /* Process to reply to */
+    const char *buf;            /* Next character to send */
+    int n;                      /* Number of characters left */
+    int cooked;                 /* Whether to expand \n to \r\n */
+    int cr;                     /* Whether \r has been sent for this \n */
+    char ch;                    /* Storage for a single PUTC character */
+} writer[NWRITE];
+static int wr_head = 0;         /* Index of first writer */
+static int n_wr = 0;            /* Number of writers in the queue */
+
+/* NREAD -- max number of processes waiting for input */
+#define NREAD 8
+
+/* Queue of input requests */
+static struct reader {
+    int client;                 /* Process waiting for input */
+    int kind;                   /* GETC, GETLINE or READ */
+    char *buf;                  /* Buffer for GETLINE or READ */
+    int n;                      /* Size of buffer */
+    int count;                  /* Characters received so far */
+    unsigned deadline;          /* Time limit for READ, or 0 */
+} reader[NREAD];
+static int n_rd = 0;            /* Number of readers in the queue */
+
+static int raw = 0;             /* True in raw input mode */
+
+static unsigned alarm_at = 0;   /* Time the alarm is set for, or 0 */
 
 static int txidle = 1;          /* True if transmitter is idle */
 
@@ -57,6 +114,15 @@ static void echo(char ch)
 /* keypress -- deal with keyboard character by editing buffer */
 static void keypress(char ch)
 {
+    if (raw) {
+        /* Make each character available as it arrives */
+        if (n_avail == NBUF) return;
+        rxbuf[rx_inp] = ch;
+        rx_inp = wrap(rx_inp+1);
+        n_avail++;
+        return;
+    }
+
     switch (ch) {
     case '\b':
     case 0177:
@@ -122,51 +188,279 @@ static void serial_interrupt(void)
     enable_irq(UART_IRQ);
 }
 
-/* reply -- send reply or start transmitter if possible */
-static void reply(void)
+/* take_char -- fetch the next output character from a writer */
+static char take_char(struct writer *w)
 {
-    message m;
-    
-    /* Can we satisfy a reader? */
-    if (reader >= 0 && n_avail > 0) {
-        m.int1 = rxbuf[rx_outp];
-        send(reader, REPLY, &m);
+    char ch = *w->buf;
+
+    if (ch == '\n' && w->cooked && !w->cr) {
+        /* Send \r first, and the \n itself next time */
+        w->cr = 1;
+        return '\r';
+    }
+
+    w->buf++; w->n--; w->cr = 0;
+    return ch;
+}
+
+/* put_tx -- add a character to txbuf, which must have space */
+static inline void put_tx(char ch)
+{
+    txbuf[tx_inp] = ch;
+    tx_inp = wrap(tx_inp+1);
+    n_tx++;
+}
+
+/* copy_out -- copy as much as possible from a writer to txbuf */
+static void copy_out(struct writer *w)
+{
+    while (w->n > 0 && n_tx < NBUF)
+        put_tx(take_char(w));
+}
+
+/* retire -- reply to writers that have finished */
+static void retire(void)
+{
+    while (n_wr > 0 && writer[wr_head].n == 0) {
+        send(writer[wr_head].client, REPLY, NULL);
+        wr_head = (wr_head+1) % NWRITE;
+        n_wr--;
+
+        /* The next writer is now at the front: start copying it */
+        if (n_wr > 0) copy_out(&writer[wr_head]);
+    }
+}
+
+/* drop_reader -- remove a reader from the queue */
+static void drop_reader(int i)
+{
+    n_rd--;
+    for (int j = i; j < n_rd; j++)
+        reader[j] = reader[j+1];
+}
+
+/* set_raw -- switch between raw and line-editing input */
+static void set_raw(int r)
+{
+    if (r && !raw) {
+        /* Any partial line becomes available as it is */
+        n_avail += n_edit;
+        n_edit = 0;
+    }
+    raw = r;
+}
+
+/* find_line -- count characters up to newline, or -1 if none */
+static int find_line(int max)
+{
+    for (int k = 0; k < n_avail && k < max; k++) {
+        if (rxbuf[wrap(rx_outp+k)] == '\n')
+            return k+1;
+    }
+
+    return (n_avail >= max ? max : -1);
+}
+
+/* take_input -- copy n available characters to a buffer */
+static void take_input(char *buf, int n)
+{
+    for (int i = 0; i < n; i++) {
+        buf[i] = rxbuf[rx_outp];
         rx_outp = wrap(rx_outp+1);
-        n_avail--;
-        reader = -1;
     }
+    n_avail -= n;
+}
+
+/* serve_readers -- satisfy waiting readers in turn if possible */
+static void serve_readers(void)
+{
+    message m;
+    char ch;
+    int k;
+
+    while (n_rd > 0) {
+        struct reader *r = &reader[0];
+        set_raw(r->kind == READ);
+
+        switch (r->kind) {
+        case GETC:
+            if (n_avail == 0) return;
+            take_input(&ch, 1);
+            m.int1 = ch;
+            break;
+
+        case GETLINE:
+            /* Leave room for the terminating null */
+            k = find_line(r->n-1);
+            if (k < 0) return;
+            take_input(r->buf, k);
+            r->buf[k] = '\0';
+            m.int1 = k;
+            break;
+
+        case READ:
+            k = r->n - r->count;
+            if (k > n_avail) k = n_avail;
+            take_input(r->buf + r->count, k);
+            r->count += k;
+            if (r->count < r->n) return;
+            m.int1 = r->count;
+            break;
+
+        default:
+            panic("Bad reader");
+        }
+
+        send(r->client, REPLY, &m);
+        drop_reader(0);
+    }
+}
+
+/* check_deadlines -- give up on READ requests that have run out of time */
+static void check_deadlines(void)
+{
+    message m;
+    unsigned now = timer_now();
+    int i = 0;
+
+    while (i < n_rd) {
+        struct reader *r = &reader[i];
+        if (r->kind == READ && r->deadline != 0
+            && (int) (now - r->deadline) >= 0) {
+            m.int1 = r->count;
+            send(r->client, REPLY, &m);
+            drop_reader(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/* set_alarm -- make the alarm go off at the earliest READ deadline */
+static void set_alarm(void)
+{
+    unsigned first = 0;
+    int i, delay;
+
+    for (i = 0; i < n_rd; i++) {
+        unsigned d = reader[i].deadline;
+        if (reader[i].kind == READ && d != 0
+            && (first == 0 || (int) (d - first) < 0))
+            first = d;
+    }
+
+    if (first == alarm_at) return;
+
+    if (alarm_at != 0) timer_cancel();
+    alarm_at = first;
+
+    if (first != 0) {
+        delay = first - timer_now();
+        timer_alarm(delay > 0 ? delay : 1);
+    }
+}
+
+/* queue_read -- add an input request to the queue */
+static void queue_read(int client, int kind, char *buf, int n,
+                       unsigned deadline)
+{
+    struct reader *r;
+
+    if (n_rd == NREAD)
+        panic("Too many processes waiting for input");
+
+    r = &reader[n_rd++];
+    r->client = client;
+    r->kind = kind;
+    r->buf = buf;
+    r->n = n;
+    r->count = 0;
+    r->deadline = deadline;
+}
+
+/* reply -- send reply or start transmitter if possible */
+static void reply(void)
+{
+    /* Can we satisfy any readers? */
+    serve_readers();
 
     /* Can we start transmitting a character? */
-    if (txidle && n_tx > 0) {
-        UART.TXD = txbuf[tx_outp];
-        tx_outp = wrap(tx_outp+1);
-        n_tx--;
-        txidle = 0;
+    if (txidle) {
+        if (n_tx > 0) {
+            UART.TXD = txbuf[tx_outp];
+            tx_outp = wrap(tx_outp+1);
+            n_tx--;
+            txidle = 0;
+        } else if (n_wr > 0) {
+            /* Send straight from the client's buffer */
+            UART.TXD = take_char(&writer[wr_head]);
+            txidle = 0;
+            retire();
+        }
     }
 }
 
-/* queue_char -- add character to output buffer */
-static void queue_char(char ch)
+/* new_writer -- allocate a writer at the end of the queue */
+static struct writer *new_writer(int client, const char *buf, int n,
+                                 int cooked)
 {
-    while (n_tx == NBUF) {
-        /* The buffer is full -- wait for a space to appear */
-        receive(INTERRUPT, NULL);
-        serial_interrupt();
-        reply();
+    struct writer *w;
+
+    if (n_wr == NWRITE)
+        panic("Too many processes waiting for output");
+
+    w = &writer[(wr_head+n_wr) % NWRITE];
+    w->client = client;
+    w->buf = buf;
+    w->n = n;
+    w->cooked = cooked;
+    w->cr = 0;
+    n_wr++;
+    return w;
+}
+
+/* start_writer -- if a new writer is at the front, copy what fits */
+static void start_writer(struct writer *w)
+{
+    if (w == &writer[wr_head]) {
+        copy_out(w);
+        retire();               /* Perhaps reply at once */
     }
+}
 
-    txbuf[tx_inp] = ch;
-    tx_inp = wrap(tx_inp+1);
-    n_tx++;
+/* queue_write -- add an output request to the queue */
+static void queue_write(int client, const char *buf, int n, int cooked)
+{
+    start_writer(new_writer(client, buf, n, cooked));
+}
+
+/* queue_char -- add a single character to the output queue */
+static void queue_char(int client, char ch)
+{
+    struct writer *w;
+    int need = (ch == '\n' ? 2 : 1);
+
+    if (n_wr == 0 && n_tx + need <= NBUF) {
+        /* The common case: put it straight into txbuf and reply */
+        if (ch == '\n') put_tx('\r');
+        put_tx(ch);
+        send(client, REPLY, NULL);
+        return;
+    }
+
+    /* Otherwise the character must wait in a writer of its own */
+    w = new_writer(client, NULL, 1, 1);
+    w->ch = ch;
+    w->buf = &w->ch;
+    start_writer(w);
 }
 
 /* serial_task -- driver process for UART */
 static void serial_task(int arg)
 {
     message m;
-    int client, n;
+    int client;
     char ch;
-    char *buf;
 
     UART.ENABLE = UART_ENABLE_Disabled;
     UART.BAUDRATE = UART_BAUDRATE_9600; /* 9600 baud */
@@ -195,26 +489,36 @@ static void serial_task(int arg)
             break;
 
         case GETC:
-            if (reader >= 0)
-                panic("Two clients cannot wait for input at once");
-            reader = client;
+            queue_read(client, GETC, NULL, 0, 0);
+            break;
+
+        case GETLINE:
+            queue_read(client, GETLINE, m.ptr1, m.int2, 0);
+            break;
+
+        case READ:
+            queue_read(client, READ, m.ptr1, m.int2, m.int3);
+            break;
+
+        case PING:
+            /* The alarm has gone off */
+            alarm_at = 0;
+            check_deadlines();
             break;
             
         case PUTC:
             ch = m.int1;
-            if (ch == '\n') queue_char('\r');
-            queue_char(ch);
+            queue_char(client, ch);
             break;
 
         case PUTBUF:
-            buf = m.ptr1;
-            n = m.int2;
-            for (int i = 0; i < n; i++) {
-                char ch = buf[i];
-                if (ch == '\n') queue_char('\r');
-                queue_char(ch);
-            }
-            send(client, REPLY, NULL);
+            /* Text, with \n expanded to \r\n */
+            queue_write(client, m.ptr1, m.int2, 1);
+            break;
+
+        case WRITE:
+            /* Binary data, sent as it is */
+            queue_write(client, m.ptr1, m.int2, 0);
             break;
 
         default:
@@ -222,6 +526,7 @@ static void serial_task(int arg)
         }
           
         reply();
+        set_alarm();
     }
 }
 
@@ -231,25 +536,98 @@ void serial_init(void)
     SERIAL_TASK = start("Serial", serial_task, 0, 256);
 }
 
+void print_buf(char *buf, int n);
+
 /* serial_putc -- queue a character for output */
 void serial_putc(char ch)
 {
     message m;
+
+    if (get_outbuf() != NULL) {
+        print_buf(&ch, 1);
+        return;
+    }
+
     m.int1 = ch;
-    send(SERIAL_TASK, PUTC, &m);
+    sendrec(SERIAL_TASK, PUTC, &m);
 }
 
 /* serial_getc -- request an input character */
 char serial_getc(void)
 {
     message m;
-    send(SERIAL_TASK, GETC, NULL);
-    receive(REPLY, &m);
+    serial_flush();
+    sendrec(SERIAL_TASK, GETC, &m);
     return m.int1;
 }
 
-/* print_buf -- output routine for use by printf */
-void print_buf(char *buf, int n)
+/* serial_readline -- read a line of input, returning its length */
+int serial_readline(char *buf, int n)
+{
+    /* The line includes the newline if there is room for it, and is
+       always terminated with a null character. */
+    message m;
+    if (n < 1) panic("serial_readline needs space for the null");
+    serial_flush();
+    m.ptr1 = buf;
+    m.int2 = n;
+    sendrec(SERIAL_TASK, GETLINE, &m);
+    return m.int1;
+}
+
+/* serial_read -- read n bytes of raw input, or until timeout ms pass */
+int serial_read(char *buf, int n, int timeout)
+{
+    /* With timeout = 0, wait for all n bytes.  Otherwise, return the
+       number of bytes actually received before the time limit.  Time
+       limits need the timer driver. */
+    message m;
+
+    serial_flush();
+    m.int3 = 0;
+    if (timeout > 0) {
+        /* A deadline of 0 means none, so nudge it if necessary */
+        m.int3 = timer_now() + timeout;
+        if (m.int3 == 0) m.int3 = 1;
+    }
+
+    m.ptr1 = buf;
+    m.int2 = n;
+    sendrec(SERIAL_TASK, READ, &m);
+    return m.int1;
+}
+
+/* serial_write -- send a block of bytes with no translation */
+void serial_write(const char *buf, int n)
+{
+    /* The reply comes when the driver has finished with buf */
+    message m;
+    serial_flush();
+    m.ptr1 = (void *) buf;
+    m.int2 = n;
+    sendrec(SERIAL_TASK, WRITE, &m);
+}
+
+/* Each process can have its own output buffer, so that printf sends a
+whole line to the driver in one message, rather than one for every 16
+characters.  The buffer is flushed when it is full, at the end of
+each line, before the process waits for input, and on serial_flush.
+Because the flush happens before printf returns, a process that
+prints a line and then sends a message still has its line appear
+first, and each line goes to the driver in one piece, so lines from
+different processes are not mixed.  The struct outbuf is carved from
+the start of the space supplied by the client, and a pointer to it is
+kept by the kernel for each process. */
+
+/* struct outbuf -- per-process output buffer */
+struct outbuf {
+    int size;                   /* Capacity of buf */
+    int n;                      /* Characters in buf */
+    char buf[];
+};
+
+/* put_buf -- send characters to the driver */
+static void put_buf(char *buf, int n)
 {
     /* Using sendrec() here avoids a potential priority inversion:
        with separate send() and receive() calls, a lower-priority
@@ -260,3 +638,55 @@ void print_buf(char *buf, int n)
     m.int2 = n;
     sendrec(SERIAL_TASK, PUTBUF, &m);
 }
+
+/* serial_setbuf -- give the current process an output buffer */
+void serial_setbuf(char *buf, int size)
+{
+    struct outbuf *b;
+    char *base = buf;
+
+    serial_flush();
+
+    if (buf == NULL) {
+        set_outbuf(NULL);
+        return;
+    }
+
+    /* Align the header and check there is room for some characters */
+    buf = (char *) (((unsigned) buf + 3) & ~3);
+    size -= (buf - base) + sizeof(struct outbuf);
+    if (size <= 0) panic("Output buffer is too small");
+
+    b = (struct outbuf *) buf;
+    b->size = size;
+    b->n = 0;
+    set_outbuf(b);
+}
+
+/* serial_flush -- send any buffered output for the current process */
+void serial_flush(void)
+{
+    struct outbuf *b = get_outbuf();
+
+    if (b != NULL && b->n > 0) {
+        put_buf(b->buf, b->n);
+        b->n = 0;
+    }
+}
+
+/* print_buf -- output routine for use by printf */
+void print_buf(char *buf, int n)
+{
+    struct outbuf *b = get_outbuf();
+
+    if (b == NULL) {
+        put_buf(buf, n);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (b->n == b->size) serial_flush();
+        b->buf[b->n++] = buf[i];
+        if (buf[i] == '\n') serial_flush();
+    }
+}
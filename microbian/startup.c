@@ -115,6 +115,10 @@ volatile _DEVICE _i2c * const I2C[2] = {
     &I2C0, &I2C1
 };
 
+volatile _DEVICE _twim * const TWIM[2] = {
+    &TWIM0, &TWIM1
+};
+
 volatile _DEVICE _timer * const TIMER[5] = {
     &TIMER0, &TIMER1, &TIMER2, &TIMER3, &TIMER4
 };
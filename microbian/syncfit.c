@@ -0,0 +1,103 @@
+/* syncfit.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "syncfit.h"
+
+/* As in FTSP, the estimate is a least-squares line through the last
+few readings, giving the offset between the clocks and its rate of
+change, the skew.  The crystals on two boards differ by tens of parts
+per million, so the skew matters: in a second between readings, an
+error of 20ppm makes the clocks drift apart by 20 usec.
+
+Times are unsigned and may wrap around, so all arithmetic is done on
+differences: local times relative to the newest reading, and offsets
+relative to its offset.  With readings a second apart, the products
+in the sums need 64 bits, and if readings are lost, so that the ones
+that are kept are many seconds apart, the sums must be scaled down
+before computing the skew.  The skew is a fixed-point fraction with
+SYNC_SKEWBITS bits after the binary point, so the resolution is about
+0.06ppm.
+
+A reading that disagrees with the line by more than SYNC_OUTLIER
+usec probably means the reference has changed or been reset, so the
+old readings are thrown away. */
+
+#define SXY_MAX (1LL << (62 - SYNC_SKEWBITS)) /* Limit before shifting */
+
+/* sync_init -- start with no readings */
+void sync_init(struct sync_fit *f)
+{
+    f->n = f->next = 0;
+    f->ref_local = 0;
+    f->ref_offset = 0;
+    f->skew = 0;
+}
+
+/* sync_global -- convert a local time to reference time */
+unsigned sync_global(struct sync_fit *f, unsigned local)
+{
+    long long d = (int) (local - f->ref_local);
+    return local + f->ref_offset + ((d * f->skew) >> SYNC_SKEWBITS);
+}
+
+/* sync_ppm -- skew in parts per million */
+int sync_ppm(struct sync_fit *f)
+{
+    return ((long long) f->skew * 1000000) >> SYNC_SKEWBITS;
+}
+
+/* fit -- recompute the line through the readings */
+static void fit(struct sync_fit *f)
+{
+    int last = (f->next + SYNC_NPOINTS - 1) % SYNC_NPOINTS;
+    long long sx = 0, sy = 0, sxx = 0, sxy = 0, mx, my;
+    int n = f->n;
+
+    /* Sums of x = local time and y = offset, relative to the newest */
+    for (int i = 0; i < n; i++) {
+        long long x = (int) (f->local[i] - f->local[last]);
+        long long y = f->offset[i] - f->offset[last];
+        sx += x; sy += y;
+    }
+
+    /* Means, then sums of squares about the means */
+    mx = sx / n; my = sy / n;
+    for (int i = 0; i < n; i++) {
+        long long x = (int) (f->local[i] - f->local[last]) - mx;
+        long long y = f->offset[i] - f->offset[last] - my;
+        sxx += x * x; sxy += x * y;
+    }
+
+    /* With readings far apart, sxy << SYNC_SKEWBITS would overflow,
+       so scale both sums down first; sxx stays large, so little
+       precision is lost */
+    while (sxy >= SXY_MAX || sxy <= -SXY_MAX) {
+        sxy /= 2; sxx /= 2;
+    }
+
+    f->skew = (sxx == 0 ? 0 : (sxy << SYNC_SKEWBITS) / sxx);
+
+    /* The line passes through the mean */
+    f->ref_local = f->local[last] + mx;
+    f->ref_offset = f->offset[last] + my;
+}
+
+/* sync_add -- add a reading and return its error against the old fit */
+int sync_add(struct sync_fit *f, unsigned local, unsigned ref)
+{
+    int err = 0;
+
+    if (f->n > 0) {
+        err = ref - sync_global(f, local);
+        if (err > SYNC_OUTLIER || err < -SYNC_OUTLIER)
+            sync_init(f);
+    }
+
+    f->local[f->next] = local;
+    f->offset[f->next] = ref - local;
+    f->next = (f->next+1) % SYNC_NPOINTS;
+    if (f->n < SYNC_NPOINTS) f->n++;
+
+    fit(f);
+    return err;
+}
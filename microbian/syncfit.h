@@ -0,0 +1,30 @@
+/* syncfit.h */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Estimate the offset and drift of a local clock against a reference
+clock, from pairs of readings taken at the same instant.  Like
+reliable.c, syncfit.c depends on nothing in microbian, so that it can
+be tested on a host computer. */
+
+#define SYNC_NPOINTS 8          /* Readings kept for the fit */
+#define SYNC_OUTLIER 1000       /* Error (usec) that restarts the fit */
+#define SYNC_SKEWBITS 24        /* Fraction bits in the skew */
+
+struct sync_fit {
+    int n;                      /* Number of readings */
+    int next;                   /* Where to put the next one */
+    unsigned local[SYNC_NPOINTS]; /* Local times */
+    int offset[SYNC_NPOINTS];   /* Reference minus local */
+
+    /* The fitted line: reference = local + ref_offset
+       + skew * (local - ref_local) / 2^SYNC_SKEWBITS, so a local
+       clock that runs fast has a negative skew */
+    unsigned ref_local;
+    int ref_offset;
+    int skew;
+};
+
+void sync_init(struct sync_fit *f);
+int sync_add(struct sync_fit *f, unsigned local, unsigned ref);
+unsigned sync_global(struct sync_fit *f, unsigned local);
+int sync_ppm(struct sync_fit *f);
@@ -16,6 +16,8 @@ static int TIMER_TASK;
 
 #define MAX_TIMERS 8
 
+#define TIMER_PPI 10            /* PPI channel that counts ticks */
+
 /* Millis will overflow in about 46 days, but that's long enough. */
 
 /* millis -- milliseconds since boot */
@@ -36,19 +38,23 @@ static struct {
 /* check_timers -- send any messages that are due */
 static void check_timers(void)
 {
-    int i;
+    int i, client;
     message m;
 
     for (i = 0; i < MAX_TIMERS; i++) {
         if (timer[i].client >= 0 && millis >= timer[i].next) {
+            /* Update the entry before sending, because the client
+               may change the table with timer_alarm or timer_cancel
+               as soon as it has the message */
+            client = timer[i].client;
             m.int1 = timer[i].next;
-            send(timer[i].client, PING, &m);
 
             if (timer[i].period > 0)
                 timer[i].next += timer[i].period;
             else
                 timer[i].client = -1;
 
+            send(client, PING, &m);
         }
     }
 }
@@ -56,8 +62,13 @@ static void check_timers(void)
 /* create -- create a new timer */
 static void create(int client, int delay, int repeat)
 {
+    unsigned prev = get_primask();
     int i = 0;
 
+    /* Interrupts are off because timer_alarm can call this from a
+       process other than the timer task */
+    intr_disable();
+
     while (i < MAX_TIMERS && timer[i].client >= 0)
         i++;
 
@@ -74,6 +85,7 @@ static void create(int client, int delay, int repeat)
     timer[i].client = client;
     timer[i].next = millis + delay;
     timer[i].period = repeat;
+    set_primask(prev);
 }
 
 /* timer1_handler -- interrupt handler */
@@ -102,6 +114,17 @@ static void timer_task(int n)
     TIMER1.CC[0] = 1000 * TICK;
     TIMER1.SHORTS = BIT(TIMER_COMPARE0_CLEAR);
     TIMER1.INTENSET = BIT(TIMER_INT_COMPARE0);
+
+    /* Timer 2 counts the ticks for timer_captured */
+    TIMER2.STOP = 1;
+    TIMER2.MODE = TIMER_MODE_Counter;
+    TIMER2.BITMODE = TIMER_BITMODE_32Bit;
+    TIMER2.CLEAR = 1;
+    TIMER2.START = 1;
+    PPI.CH[TIMER_PPI].EEP = &TIMER1.COMPARE[0];
+    PPI.CH[TIMER_PPI].TEP = &TIMER2.COUNT;
+    PPI.CHENSET = BIT(TIMER_PPI);
+
     TIMER1.START = 1;
     enable_irq(TIMER1_IRQ);
 
@@ -114,7 +137,7 @@ static void timer_task(int n)
             break;
 
         case REGISTER:
-            create(m.sender, m.int1, m.int2);
+            create(m.int3, m.int1, m.int2);
             break;
 
         default:
@@ -179,25 +202,82 @@ unsigned timer_micros(void)
     return 1000 * my_millis + ticks1;
 }
 
+/* Capture register CC[3] of TIMER1 is left free so that other
+hardware can capture the time through PPI: the radio driver uses it to
+timestamp packets.  The captured count is only a fraction of a tick,
+and a packet can take longer than a tick to arrive, so the same event
+is forked to capture the number of ticks, which TIMER2 counts in step
+with millis.  timer_capture sets up a PPI channel to do both, and
+timer_captured puts the two together, however long ago the event was,
+until the count is overwritten by the next event. */
+
+/* timer_capture -- make PPI channel ch capture the time */
+void timer_capture(int ch)
+{
+    /* The caller sets the event and enables the channel */
+    PPI.CH[ch].TEP = &TIMER1.CAPTURE[3];
+    PPI.FORK[ch].TEP = &TIMER2.CAPTURE[3];
+}
+
+/* timer_captured -- convert the captured time to microseconds */
+unsigned timer_captured(void)
+{
+    return 1000 * TICK * TIMER2.CC[3] + TIMER1.CC[3];
+}
+
 /* timer_delay -- one-shot delay */
 void timer_delay(int msec)
 {
     message m;
     m.int1 = msec;
     m.int2 = 0;                 /* Don't repeat */
+    m.int3 = getpid();          /* Wake the caller */
     send(TIMER_TASK, REGISTER, &m);
     receive(PING, NULL);
 }
 
 /* timer_pulse -- regular pulse */
 void timer_pulse(int msec)
+{
+    timer_pulse_to(getpid(), msec);
+}
+
+/* timer_pulse_to -- regular pulse sent to another process */
+void timer_pulse_to(int pid, int msec)
 {
     message m;
     m.int1 = msec;
     m.int2 = msec;              /* Repetitive */
+    m.int3 = pid;
     send(TIMER_TASK, REGISTER, &m);
 }
 
+/* Driver processes that must not send to the timer task (because it
+may at the same moment be trying to send them a PING) can use
+timer_alarm and timer_cancel instead.  These change the table of
+timers directly with interrupts disabled, without sending a message,
+so they never wait.  The PING is sent later by the timer task in the
+usual way, so the caller must be ready to receive it. */
+
+/* timer_alarm -- one-shot PING to the caller after msec, without waiting */
+void timer_alarm(int msec)
+{
+    create(getpid(), msec, 0);
+}
+
+/* timer_cancel -- cancel all timers for the caller */
+void timer_cancel(void)
+{
+    unsigned prev = get_primask();
+    int i, me = getpid();
+
+    intr_disable();
+    for (i = 0; i < MAX_TIMERS; i++) {
+        if (timer[i].client == me) timer[i].client = -1;
+    }
+    set_primask(prev);
+}
+
 /* wait -- sleep until next timer pulse */
 void timer_wait(void)
 {
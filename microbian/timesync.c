@@ -0,0 +1,147 @@
+/* timesync.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "syncfit.h"
+
+/* Time synchronisation by radio.  One board is the root, and its
+timer_micros clock is the global time.  Once every SYNC_PERIOD, the
+root broadcasts a SYNC packet and notes the time at which its address
+went out, then sends that time in a FOLLOWUP packet.  A follower
+stamps the SYNC packet with the time its address arrived, so each
+SYNC and FOLLOWUP pair gives a reading of the local and global clocks
+at the same instant, with both times captured by hardware through PPI
+and no uncertainty from interrupt latency or the time spent in the
+driver.  The radio delay itself is a fraction of a microsecond.
+
+The follower fits a line through the last few readings (see
+syncfit.c), and timer_global_micros uses it to convert local time to
+global time.  Before each new reading is added, its difference from
+the current fit is the error of the synchronisation at that moment,
+and timesync_getstats reports it.
+
+Timesync packets have their own radio protocol number, and the
+follower subscribes only to packets that also start with SYNC_TAG, so
+a program can use the radio for other things at the same time. */
+
+static int SYNC_TASK;
+
+#define SYNC_PERIOD 1000        /* Interval between SYNC packets (ms) */
+#define SYNC_TAG 0x7e           /* First byte of our packets */
+#define SYNC 'S'
+#define FOLLOWUP 'F'
+
+struct sync_packet {
+    byte tag;                   /* SYNC_TAG */
+    byte kind;                  /* SYNC or FOLLOWUP */
+    unsigned short seq;         /* Sequence number */
+    unsigned time;              /* Root time of SYNC, for FOLLOWUP */
+};
+
+static int root;                /* Whether we are the root */
+static struct sync_fit fit;     /* Current estimate */
+static struct timesync_stats stats;
+
+/* root_task -- send SYNC and FOLLOWUP packets regularly */
+static void root_task(int arg)
+{
+    struct sync_packet pkt;
+    unsigned short seq = 0;
+
+    pkt.tag = SYNC_TAG;
+    timer_pulse(SYNC_PERIOD);
+
+    while (1) {
+        timer_wait();
+        pkt.seq = seq++;
+        pkt.kind = SYNC;
+        pkt.time = radio_send_stamped(RADIO_PROTO_TIMESYNC, &pkt, 4);
+        pkt.kind = FOLLOWUP;
+        radio_send_proto(RADIO_PROTO_TIMESYNC, &pkt, sizeof(pkt));
+        stats.count++;
+    }
+}
+
+/* follower_task -- listen for packets from the root */
+static void follower_task(int arg)
+{
+    static radio_buf spare;
+    radio_buf *p = &spare;
+    struct sync_packet *pkt;
+    struct sync_fit new;
+    int seq = -1, err, warm;
+    unsigned local = 0;
+    byte tag = SYNC_TAG;
+
+    sync_init(&new);
+    radio_listen(RADIO_PROTO_TIMESYNC, &tag, 1);
+
+    while (1) {
+        p = radio_receive_buf(p);
+        pkt = (struct sync_packet *) p->data;
+        if (p->length-3 < 4) continue;
+
+        switch (pkt->kind) {
+        case SYNC:
+            seq = pkt->seq;
+            local = p->time;
+            break;
+
+        case FOLLOWUP:
+            if (pkt->seq != seq) break;
+            seq = -1;
+
+            /* Update a copy, so timer_global_micros sees either the
+               old fit or the new one.  Errors count only once the fit
+               has settled down. */
+            warm = (new.n == SYNC_NPOINTS);
+            err = sync_add(&new, local, pkt->time);
+            intr_disable();
+            fit = new;
+            intr_enable();
+
+            if (warm) {
+                stats.error = err;
+                if (err < 0) err = -err;
+                if (err > stats.max_error) stats.max_error = err;
+            }
+            stats.count++;
+            stats.skew = sync_ppm(&new);
+            stats.synced = (new.n >= 2);
+            break;
+        }
+    }
+}
+
+/* timer_global_micros -- return global time in microseconds */
+unsigned timer_global_micros(void)
+{
+    unsigned t = timer_micros();
+
+    if (root || ! stats.synced) return t;
+
+    intr_disable();
+    t = sync_global(&fit, t);
+    intr_enable();
+    return t;
+}
+
+/* timesync_getstats -- fetch the state of synchronisation */
+void timesync_getstats(struct timesync_stats *st)
+{
+    *st = stats;
+}
+
+/* timesync_init -- start as the root or as a follower */
+void timesync_init(int is_root)
+{
+    root = is_root;
+    sync_init(&fit);
+
+    if (root) {
+        stats.synced = 1;
+        SYNC_TASK = start("Sync", root_task, 0, 256);
+    } else
+        SYNC_TASK = start("Sync", follower_task, 0, 512);
+}
@@ -3,18 +3,30 @@
 
 /* Squirt a text file at the micro:bit */
 
+/* Programs that poll the UART for each character can't keep up if
+the file is sent at full speed, so by default we pause after each
+character.  Programs that use the micro:bian serial driver buffer
+their input, and for them the -f flag sends the file at full line
+rate. */
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define DEVICE "/dev/ttyACM0"   /* TTY device for the micro:bit */
 
 int main(int argc, char **argv)
 {
     FILE *fin, *fout;
+    int fast = 0;
+
+    if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        fast = 1; argc--; argv++;
+    }
 
     if (argc != 2) {
-        fprintf(stderr, "Usage: squirt file\n");
+        fprintf(stderr, "Usage: squirt [-f] file\n");
         exit(2);
     }
 
@@ -40,9 +52,14 @@ int main(int argc, char **argv)
         else
             fputc(ch, fout);
 
-        fflush(fout);
-        usleep(10000);
+        if (! fast) {
+            fflush(fout);
+            usleep(10000);
+        }
     }
+
+    fclose(fout);
+    return 0;
 }
 
 
@@ -0,0 +1,7 @@
+/* x19-servos/pwm.h */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Two-channel PWM for the wheel motors on pads 1 and 2 */
+
+void pwm_init(void);
+void pwm_change(int width1, int width2);
@@ -0,0 +1,273 @@
+/* x20-radio/bench.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+#include <string.h>
+
+/* Radio throughput benchmark.  Load the same program on two boards,
+and press button A on one of them: that board becomes the sender and
+runs a test in each radio mode, printing a line for each one.  The
+other board stays as the receiver.
+
+Each test starts with both boards on the control settings
+(Nrf_1Mbit).  The sender announces the mode, the receiver acknowledges
+it, and both switch.  The sender then sends NDATA packets as fast as
+the driver will take them, and the receiver counts them and times the
+gap from first to last using the timestamps in radio_buf, giving the
+goodput and packet loss.  Next the sender pings NPING times, waiting
+each time for the receiver to echo the packet, to measure round-trip
+latency.  Finally, the sender asks for the results and both boards go
+back to the control settings.  If the receiver hears nothing for
+WAIT_IDLE ticks, it gives up and goes back too.  The last two tests
+repeat the Nrf modes with encryption by the CCM, so comparing them
+with the first two shows the time that encryption adds to each
+packet. */
+
+#define GROUP 42
+#define CHANNEL 7
+#define POWER 0
+
+#define NDATA 1000              /* Data packets per test */
+#define PAYLOAD 64              /* Bytes in each data packet */
+#define NPING 20                /* Pings per test */
+#define NTRY 10                 /* Attempts for each handshake */
+
+#define TICK 5                  /* Timer pulse interval (ms) */
+#define WAIT_REPLY 20           /* Ticks to wait for a reply */
+#define WAIT_IDLE 400           /* Ticks before receiver gives up */
+
+/* Packet kinds */
+#define PKT_START 'S'           /* Switch to mode in arg */
+#define PKT_READY 'R'           /* Receiver has switched */
+#define PKT_DATA 'D'            /* Data packet */
+#define PKT_ECHO 'E'            /* Ping, echoed by receiver */
+#define PKT_FINISH 'F'          /* Ask for results */
+#define PKT_RESULT 'Z'          /* Results: count and elapsed time */
+
+struct pkt {
+    byte kind;                  /* Packet kind */
+    byte arg;                   /* Mode for PKT_START */
+    unsigned short seq;         /* Sequence number */
+    unsigned count;             /* Packets received, for PKT_RESULT */
+    unsigned elapsed;           /* First to last (usec), for PKT_RESULT */
+    byte fill[PAYLOAD-12];      /* Padding for data packets */
+};
+
+static const struct {
+    int mode;
+    int crypt;                  /* Whether to encrypt */
+    char *name;
+} modes[] = {
+    { RADIO_MODE_NRF_1Mbit, 0, "Nrf_1Mbit" },
+    { RADIO_MODE_NRF_2Mbit, 0, "Nrf_2Mbit" },
+    { RADIO_MODE_BLE_1Mbit, 0, "Ble_1Mbit" },
+    { RADIO_MODE_BLE_2Mbit, 0, "Ble_2Mbit" },
+    { RADIO_MODE_NRF_1Mbit, 1, "Ccm_1Mbit" },
+    { RADIO_MODE_NRF_2Mbit, 1, "Ccm_2Mbit" }
+};
+
+/* Key shared by the two boards for the encrypted tests */
+static const byte key[16] = {
+    0x6d, 0x69, 0x63, 0x72, 0x6f, 0x62, 0x69, 0x61,
+    0x6e, 0x20, 0x62, 0x65, 0x6e, 0x63, 0x68, 0x21
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+#define GOT 16                  /* Message type for a received packet */
+
+static int BENCH;
+
+/* listen_task -- pass received packets to the bench process */
+void listen_task(int dummy)
+{
+    static radio_buf spare;
+    radio_buf *p = &spare;
+    message m;
+
+    while (1) {
+        p = radio_receive_buf(p);
+        m.ptr1 = p;
+        sendrec(BENCH, GOT, &m);
+    }
+}
+
+static struct pkt in;           /* Last packet received */
+static unsigned in_time;        /* Its timestamp */
+
+/* await -- wait for a packet of a given kind, or a timeout */
+static int await(int kind, int ticks)
+{
+    message m;
+
+    while (1) {
+        receive(ANY, &m);
+        switch (m.type) {
+        case PING:
+            if (--ticks <= 0) return 0;
+            break;
+
+        case GOT: {
+            radio_buf *p = m.ptr1;
+            memcpy(&in, p->data, sizeof(in));
+            in_time = p->time;
+            send(m.sender, REPLY, NULL);
+            if (kind == 0 || in.kind == kind) return 1;
+            break;
+        }
+
+        default:
+            badmesg(m.type);
+        }
+    }
+}
+
+/* set_mode -- switch to the settings for a test */
+static void set_mode(int i)
+{
+    radio_config(modes[i].mode, CHANNEL, POWER);
+    if (modes[i].crypt) radio_encrypt(key);
+}
+
+/* reset_mode -- go back to the control settings */
+static void reset_mode(void)
+{
+    radio_encrypt(NULL);
+    radio_config(RADIO_MODE_NRF_1Mbit, CHANNEL, POWER);
+}
+
+/* put -- send a packet */
+static void put(int kind, int arg, int seq, int size)
+{
+    struct pkt out;
+    out.kind = kind;
+    out.arg = arg;
+    out.seq = seq;
+    out.count = out.elapsed = 0;
+    radio_send(&out, size);
+}
+
+/* handshake -- send a packet until the expected reply arrives */
+static int handshake(int kind, int arg, int reply)
+{
+    for (int i = 0; i < NTRY; i++) {
+        put(kind, arg, 0, 4);
+        if (await(reply, WAIT_REPLY)) return 1;
+    }
+
+    return 0;
+}
+
+/* run_test -- test one mode as the sender and print the results */
+static void run_test(int i)
+{
+    unsigned t0, t1, rtt = 0, kbps, air;
+    int nrtt = 0;
+
+    if (! handshake(PKT_START, i, PKT_READY)) {
+        printf("%-10s no reply\n", modes[i].name);
+        await(-1, WAIT_IDLE);
+        return;
+    }
+
+    set_mode(i);
+    air = radio_airtime(PAYLOAD);
+    await(-1, 2);               /* Let the receiver switch */
+
+    t0 = timer_micros();
+    for (int k = 0; k < NDATA; k++)
+        put(PKT_DATA, 0, k, PAYLOAD);
+    t1 = timer_micros();
+
+    for (int k = 0; k < NPING; k++) {
+        unsigned t = timer_micros();
+        put(PKT_ECHO, 0, k, 4);
+        if (await(PKT_ECHO, WAIT_REPLY)) {
+            rtt += timer_micros() - t;
+            nrtt++;
+        }
+    }
+
+    if (! handshake(PKT_FINISH, 0, PKT_RESULT)) {
+        printf("%-10s no results\n", modes[i].name);
+        reset_mode();
+        await(-1, WAIT_IDLE);
+        return;
+    }
+
+    reset_mode();
+
+    kbps = (in.elapsed == 0 ? 0 : in.count * PAYLOAD * 8000 / in.elapsed);
+    printf("%-10s %5u kbit/s (send %5u) loss %.1q%% rtt %5u us"
+           " airtime %u us\n",
+           modes[i].name, kbps, NDATA * PAYLOAD * 8000 / (t1 - t0),
+           100 * (NDATA - in.count), NDATA,
+           (nrtt == 0 ? 0 : rtt / nrtt), air);
+}
+
+/* receiver -- take part in a test as the receiver */
+static void receiver(void)
+{
+    unsigned count = 0, first = 0, last = 0;
+    struct pkt res;
+
+    set_mode(in.arg);
+
+    while (await(0, WAIT_IDLE)) {
+        switch (in.kind) {
+        case PKT_DATA:
+            if (count++ == 0) first = in_time;
+            last = in_time;
+            break;
+
+        case PKT_ECHO:
+            put(PKT_ECHO, 0, in.seq, 4);
+            break;
+
+        case PKT_FINISH:
+            res.kind = PKT_RESULT;
+            res.count = count;
+            res.elapsed = last - first;
+            /* Send the results a few times, in case one is lost */
+            for (int i = 0; i < 3; i++)
+                radio_send(&res, 12);
+            reset_mode();
+            return;
+        }
+    }
+
+    reset_mode();
+}
+
+/* bench_task -- wait to be a sender or receiver */
+void bench_task(int dummy)
+{
+    gpio_connect(BUTTON_A);
+    timer_pulse(TICK);
+
+    printf("Press A to start the benchmark\n");
+
+    while (1) {
+        if (gpio_in(BUTTON_A) == 0) {
+            printf("%d packets of %d bytes\n", NDATA, PAYLOAD);
+            for (int i = 0; i < NMODES; i++)
+                run_test(i);
+            printf("Done\n");
+        } else if (await(PKT_START, 1) && in.arg < NMODES) {
+            put(PKT_READY, 0, 0, 4);
+            receiver();
+        }
+    }
+}
+
+void init(void)
+{
+    serial_init();
+    radio_init();
+    radio_group(GROUP);
+    timer_init();
+    BENCH = start("Bench", bench_task, 0, STACK);
+    start("Listen", listen_task, 0, STACK);
+}
@@ -13,9 +13,6 @@
 #define RTC_HOUR 0x02
 #define RTC_WKDAY 0x03
 
-/* neoframe -- output a neopixel string */
-void neoframe(unsigned pin, unsigned *buf, int n);
-
 /* rgb -- assemble a colour from RGB components */
 unsigned rgb(unsigned r, unsigned g, unsigned b)
 {
@@ -30,22 +27,23 @@ unsigned bcd_decode(unsigned val)
 
 void main_task(int arg)
 {
-    int secs, mins, hours, weekday;
+    int secs, mins, hours;
     byte buf[3];
     unsigned frame[60];
 
+    /* The control register can be cached, but the others change as
+       the clock runs */
+    i2c_cache(I2C_EXTERNAL, RTC_ADDR, RTC_CONTROL);
+
     /* Disable external oscillator */
     i2c_write_reg(I2C_EXTERNAL, RTC_ADDR, RTC_CONTROL, 0x00);
 
     /* Start the clock oscillator */
-    secs = i2c_read_reg(I2C_EXTERNAL, RTC_ADDR, RTC_SEC) & 0x7f;
-    i2c_write_reg(I2C_EXTERNAL, RTC_ADDR, RTC_SEC, secs | 0x80);
-
-    /* Enable backup battery */
-    weekday = i2c_read_reg(I2C_EXTERNAL, RTC_ADDR, RTC_WKDAY) & 0x07;
-    i2c_write_reg(I2C_EXTERNAL, RTC_ADDR, RTC_WKDAY, weekday | 0x08);
+    i2c_update_reg(I2C_EXTERNAL, RTC_ADDR, RTC_SEC, 0x80, 0x80);
 
-    gpio_dir(PAD8, 1);
+    /* Enable backup battery, clearing the power-fail flag and
+       the rest of the top five bits */
+    i2c_update_reg(I2C_EXTERNAL, RTC_ADDR, RTC_WKDAY, 0xf8, 0x08);
 
     timer_pulse(100);
 
@@ -66,9 +64,7 @@ void main_task(int arg)
             frame[5*hours+1] = rgb(0, 0, 10);
         frame[mins] = rgb(0, 20, 0);
         frame[secs] = rgb(20, 0, 0);
-        intr_disable();
-        neoframe(PAD8, frame, 60);
-        intr_enable();
+        neopixel_show(PAD8, frame, 60);
     }
 }
 
@@ -77,5 +73,6 @@ void init(void)
     timer_init();
     i2c_init(I2C_EXTERNAL);
     serial_init();
+    neopixel_init();
     start("Main", main_task, 0, STACK);
 }
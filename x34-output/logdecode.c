@@ -0,0 +1,295 @@
+/* x34-output/logdecode.c */
+/* Copyright (c) 2020 J. M. Spivey */
+
+/* Decode binary log records sent by microbian/log.c.  Usage:
+
+    $ logdecode prog.elf [device]
+
+The format strings are read from the .logfmt section of the ELF file
+for the program running on the micro:bit, and frames arriving on the
+serial device (default /dev/ttyACM0, or any file) are printed as text,
+one per line.  Other characters are copied to the output unchanged, so
+ordinary printf output still appears. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <elf.h>
+
+#define DEVICE "/dev/ttyACM0"   /* TTY device for the micro:bit */
+
+/* These must agree with microbian.h */
+#define LOG_MAXARGS 6
+#define LOG_SYNC 0xa5
+#define LOG_VALID 0x80000000
+#define LOG_NSHIFT 24
+#define LOG_NMASK 0x7f
+#define LOG_DROPPED 0xffffff
+
+static char *fmts;              /* Contents of .logfmt section */
+static unsigned nfmts;          /* Its size */
+
+/* load_formats -- read the .logfmt section from an ELF file */
+static void load_formats(const char *fname)
+{
+    FILE *fp = fopen(fname, "rb");
+    Elf32_Ehdr eh;
+    Elf32_Shdr *sh;
+    char *names;
+
+    if (fp == NULL) {
+        fprintf(stderr, "logdecode: couldn't open %s\n", fname);
+        exit(1);
+    }
+
+    if (fread(&eh, sizeof(eh), 1, fp) != 1
+        || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0
+        || eh.e_ident[EI_CLASS] != ELFCLASS32) {
+        fprintf(stderr, "logdecode: %s is not a 32-bit ELF file\n", fname);
+        exit(1);
+    }
+
+    sh = calloc(eh.e_shnum, sizeof(Elf32_Shdr));
+    fseek(fp, eh.e_shoff, SEEK_SET);
+    if (fread(sh, sizeof(Elf32_Shdr), eh.e_shnum, fp) != eh.e_shnum) {
+        fprintf(stderr, "logdecode: couldn't read section headers\n");
+        exit(1);
+    }
+
+    names = malloc(sh[eh.e_shstrndx].sh_size);
+    fseek(fp, sh[eh.e_shstrndx].sh_offset, SEEK_SET);
+    fread(names, 1, sh[eh.e_shstrndx].sh_size, fp);
+
+    for (int i = 0; i < eh.e_shnum; i++) {
+        if (strcmp(&names[sh[i].sh_name], ".logfmt") == 0) {
+            nfmts = sh[i].sh_size;
+            fmts = malloc(nfmts+1);
+            fseek(fp, sh[i].sh_offset, SEEK_SET);
+            fread(fmts, 1, nfmts, fp);
+            fmts[nfmts] = '\0';
+            break;
+        }
+    }
+
+    if (fmts == NULL) {
+        fprintf(stderr, "logdecode: no .logfmt section in %s\n", fname);
+        exit(1);
+    }
+
+    free(names); free(sh); fclose(fp);
+}
+
+/* print_record -- format a record like printf on the micro:bit */
+static void print_record(unsigned id, unsigned *args, int nargs)
+{
+    int i = 0;
+    char spec[32];
+
+    if (id == LOG_DROPPED) {
+        printf("[%u log records dropped]\n", args[0]);
+        return;
+    }
+
+    for (const char *p = &fmts[id]; *p != '\0'; p++) {
+        if (*p != '%' || *(p+1) == '\0') {
+            putchar(*p);
+            continue;
+        }
+
+        /* Collect flags, width and precision, and pass them to printf.
+           A 64-bit argument is logged as two words, low word first,
+           by LOG_U64 in microbian.h. */
+        int k = 0, wide = 0, left = 0, zero = 0, width = 0, prec = -1;
+        unsigned long long x;
+        spec[k++] = *p++;
+        while ((*p == '-' || *p == '0') && k < 8) {
+            if (*p == '-') left = 1; else zero = 1;
+            spec[k++] = *p++;
+        }
+        while (*p >= '0' && *p <= '9' && k < 16) {
+            width = 10 * width + (*p - '0');
+            spec[k++] = *p++;
+        }
+        if (*p == '.') {
+            prec = atoi(p+1);
+            spec[k++] = *p++;
+            while (*p >= '0' && *p <= '9' && k < 24)
+                spec[k++] = *p++;
+        }
+        while (*p == 'l') {
+            wide = 1; p++;
+        }
+        if (*p == '\0') break;
+
+        x = (i < nargs ? args[i++] : 0);
+        if (wide && *p != 'q') {
+            x |= (unsigned long long) (i < nargs ? args[i++] : 0) << 32;
+            spec[k++] = 'l'; spec[k++] = 'l';
+        }
+
+        switch (*p) {
+        case 'c':
+            spec[k++] = 'c'; spec[k] = '\0';
+            printf(spec, (int) x);
+            break;
+        case 'd':
+            spec[k++] = 'd'; spec[k] = '\0';
+            if (wide)
+                printf(spec, (long long) x);
+            else
+                printf(spec, (int) x);
+            break;
+        case 'u':
+            spec[k++] = 'u'; spec[k] = '\0';
+            if (wide)
+                printf(spec, x);
+            else
+                printf(spec, (unsigned) x);
+            break;
+        case 'x': {
+            /* The micro:bit printf puts 0x in front of non-zero hex
+               and counts it in the field width, with any zero padding
+               going between the prefix and the digits */
+            char digits[24];
+            const char *prefix = (x != 0 ? "0x" : "");
+            int pad = width - (int) strlen(prefix)
+                - sprintf(digits, "%llx", x);
+            if (!left && !zero) printf("%*s", (pad > 0 ? pad : 0), "");
+            printf("%s", prefix);
+            if (zero && !left) printf("%.*d", (pad > 0 ? pad : 0), 0);
+            printf("%s", digits);
+            if (left) printf("%*s", (pad > 0 ? pad : 0), "");
+            break;
+        }
+        case 'q': {
+            /* Fixed point t/s, taking two arguments */
+            unsigned s = (i < nargs ? args[i++] : 1);
+            unsigned long long m = s;
+            int n = 0;
+
+            /* Places are limited as in fixtoa on the device */
+            if (prec < 0) prec = 3;
+            while (n < prec && m * 10 <= 0x100000000ULL) {
+                m *= 10; n++;
+            }
+            if (s == 0)
+                printf("%*s", (left ? -width : width), "?");
+            else
+                printf("%*.*f", (left ? -width : width), n,
+                       (double) x / s);
+            break;
+        }
+        case 's':
+            printf("<string %#x>", (unsigned) x);
+            break;
+        default:
+            putchar(*p);
+            break;
+        }
+    }
+
+    putchar('\n');
+}
+
+#define NBUF 256
+
+static unsigned char buf[NBUF];
+static int nbuf = 0;
+
+/* get_word -- fetch a little-endian word from the buffer */
+static unsigned get_word(unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24);
+}
+
+/* try_frame -- decode frame at start of buffer; return bytes used,
+   0 if there is not a valid frame, or -1 if more bytes are needed */
+static int try_frame(void)
+{
+    unsigned hdr, id, args[LOG_MAXARGS];
+    int nargs, len;
+    unsigned char sum = 0;
+
+    if (nbuf < 5) return -1;
+    hdr = get_word(&buf[1]);
+    nargs = (hdr >> LOG_NSHIFT) & LOG_NMASK;
+    id = hdr & LOG_DROPPED;
+
+    if ((hdr & LOG_VALID) == 0 || nargs > LOG_MAXARGS
+        || (id >= nfmts && id != LOG_DROPPED))
+        return 0;
+
+    len = 1 + 4*(nargs+1) + 1;
+    if (nbuf < len) return -1;
+
+    for (int i = 1; i < len-1; i++)
+        sum += buf[i];
+    if (sum != buf[len-1]) return 0;
+
+    for (int i = 0; i < nargs; i++)
+        args[i] = get_word(&buf[5+4*i]);
+
+    print_record(id, args, nargs);
+    return len;
+}
+
+/* set_raw -- put the serial port in raw mode */
+static void set_raw(int fd)
+{
+    struct termios t;
+
+    if (tcgetattr(fd, &t) < 0) return; /* Not a tty */
+    cfmakeraw(&t);
+    cfsetspeed(&t, B9600);
+    tcsetattr(fd, TCSANOW, &t);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev = DEVICE;
+    int fd, n;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: logdecode file.elf [device]\n");
+        exit(2);
+    }
+
+    load_formats(argv[1]);
+    if (argc == 3) dev = argv[2];
+
+    fd = open(dev, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "logdecode: couldn't open %s\n", dev);
+        exit(1);
+    }
+    set_raw(fd);
+
+    while ((n = read(fd, &buf[nbuf], NBUF-nbuf)) > 0) {
+        nbuf += n;
+
+        while (nbuf > 0) {
+            int k = 0;
+
+            if (buf[0] == LOG_SYNC) {
+                k = try_frame();
+                if (k < 0) break;
+            }
+
+            if (k == 0) {
+                /* Not a frame: copy a character of text */
+                if (buf[0] != '\r') putchar(buf[0]);
+                k = 1;
+            }
+
+            memmove(buf, &buf[k], nbuf-k);
+            nbuf -= k;
+        }
+
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/* x34-output/logging.c */
+/* Copyright (c) 2020 J. M. Spivey */
+
+#include "hardware.h"
+#include "microbian.h"
+#include "lib.h"
+
+/* This program prints primes like the one in x14, but records them
+with LOG instead of printf, and compares the cost of the two methods
+using the cycle counter.  Run it with
+
+    $ ./logdecode logging.elf
+
+to see the output as text. */
+
+#define cycles_start()  DWT.CYCCNT = 0
+#define cycles_stop()   DWT.CYCCNT
+
+/* prime -- test for primality */
+int prime(int n)
+{
+    for (int k = 2; k * k <= n; k++) {
+        if (n % k == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* compare -- measure the cost of formatting a message on the device */
+void compare(void)
+{
+    char buf[64];
+    unsigned t1, t2;
+
+    cycles_start();
+    sprintf(buf, "prime(%d) = %d\n", 1234, 5678);
+    t1 = cycles_stop();
+
+    cycles_start();
+    LOG("prime(%d) = %d", 1234, 5678);
+    t2 = cycles_stop();
+
+    LOG("sprintf: %u cycles, LOG: %u cycles", t1, t2);
+}
+
+/* prime_task -- log primes */
+void prime_task(int arg)
+{
+    int n = 2, count = 0;
+
+    compare();
+
+    while (1) {
+        if (prime(n)) {
+            count++;
+            LOG("prime(%d) = %d", count, n);
+            if (count % 100 == 0)
+                printf("%d primes so far\n", count);
+        }
+        n++;
+    }
+}
+
+void init(void)
+{
+    /* Enable the cycle counter */
+    SET_BIT(DEBUG.DEMCR, DEBUG_DEMCR_TRCENA);
+    SET_BIT(DWT.CTRL, DWT_CTRL_CYCCNTENA);
+
+    serial_init();
+    timer_init();
+    log_init();
+    start("Prime", prime_task, 0, STACK);
+}
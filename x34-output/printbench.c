@@ -0,0 +1,131 @@
+/* x34-output/printbench.c */
+/* Copyright (c) 2020 J. M. Spivey */
+
+#include "hardware.h"
+#include "microbian.h"
+#include "lib.h"
+
+/* Measure the cost of sprintf in the library against the earlier
+version, which converted numbers using a divide instruction for each
+digit.  The old code is copied here, cut down to just %d and %u. */
+
+#define NMAX 16
+
+/* old_utoa -- convert unsigned to decimal or hex using division */
+static char *old_utoa(unsigned x, unsigned base, char *nbuf)
+{
+    char *p = &nbuf[NMAX];
+    const char *hex = "0123456789abcdef";
+
+    *--p = '\0';
+    do {
+        *--p = hex[x % base];
+        x = x / base;
+    } while (x != 0);
+
+    return p;
+}
+
+/* old_itoa -- convert signed integer to decimal */
+static char *old_itoa(int v, char *nbuf)
+{
+    if (v >= 0)
+        return old_utoa(v, 10, nbuf);
+    else {
+        char *p = old_utoa(-v, 10, nbuf);
+        *--p = '-';
+        return p;
+    }
+}
+
+/* old_sprintf -- the old skeleton, storing characters directly */
+static int old_sprintf(char *buf, const char *fmt, ...)
+{
+    char nbuf[NMAX], *q = buf, *s;
+    va_list va;
+
+    va_start(va, fmt);
+    for (const char *p = fmt; *p != 0; p++) {
+        if (*p == '%' && *(p+1) != '\0') {
+            switch (*++p) {
+            case 'd':
+                s = old_itoa(va_arg(va, int), nbuf);
+                while (*s != '\0') *q++ = *s++;
+                break;
+            case 'u':
+                s = old_utoa(va_arg(va, unsigned), 10, nbuf);
+                while (*s != '\0') *q++ = *s++;
+                break;
+            default:
+                *q++ = *p;
+                break;
+            }
+        } else {
+            *q++ = *p;
+        }
+    }
+    va_end(va);
+    *q++ = '\0';
+    return q - buf;
+}
+
+#define cycles_start()  DWT.CYCCNT = 0
+#define cycles_stop()   DWT.CYCCNT
+
+/* Test values, with a range of lengths */
+static const int values[] = {
+    0, 7, -42, 1234, 99999, -1000000, 123456789, 2147483647
+};
+
+#define NVALUES (sizeof(values) / sizeof(values[0]))
+
+/* bench_task -- run the comparisons and print the results */
+void bench_task(int arg)
+{
+    char buf[64];
+    unsigned t_old[NVALUES], t_new[NVALUES], t_pad[NVALUES];
+    unsigned t_long, t_fixed;
+
+    /* Take all the measurements before printing anything, so that
+       serial interrupts don't disturb them */
+    for (int i = 0; i < NVALUES; i++) {
+        int v = values[i];
+
+        cycles_start();
+        old_sprintf(buf, "%d", v);
+        t_old[i] = cycles_stop();
+
+        cycles_start();
+        sprintf(buf, "%d", v);
+        t_new[i] = cycles_stop();
+
+        cycles_start();
+        sprintf(buf, "%010d", v);
+        t_pad[i] = cycles_stop();
+    }
+
+    cycles_start();
+    snprintf(buf, sizeof(buf), "%lu", 12345678901234567ULL);
+    t_long = cycles_stop();
+
+    cycles_start();
+    snprintf(buf, sizeof(buf), "%.3q", 22, 7);
+    t_fixed = cycles_stop();
+
+    printf("\nFormatting benchmark (cycles per call)\n");
+    printf("%12s %6s %6s %6s\n", "value", "old", "new", "%010d");
+    for (int i = 0; i < NVALUES; i++)
+        printf("%12d %6u %6u %6u\n", values[i], t_old[i], t_new[i], t_pad[i]);
+    printf("%%lu of 12345678901234567: %u cycles\n", t_long);
+    printf("%%.3q of 22/7 (%s): %u cycles\n", buf, t_fixed);
+}
+
+void init(void)
+{
+    /* Enable the cycle counter */
+    SET_BIT(DEBUG.DEMCR, DEBUG_DEMCR_TRCENA);
+    SET_BIT(DWT.CTRL, DWT_CTRL_CYCCNTENA);
+
+    serial_init();
+    start("Bench", bench_task, 0, STACK);
+}
@@ -0,0 +1,229 @@
+/* x35-reliable/relsim.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Test the protocol in microbian/reliable.c on the host, with two
+connections joined by a simulated radio link.  Usage:
+
+    $ relsim [-d drop] [-w window] [-n count] [-s seed] [-v]
+
+The link is half-duplex like the radio: each packet occupies the
+channel for its airtime at 1Mbit/s plus a turnaround time, and is
+then either delivered or, with probability drop, lost.  As with the
+radio driver, each node can have at most NTX packets waiting to go, and
+a node that sends another packet is held up until one of them has
+gone, so it cannot act on timer ticks or incoming packets meanwhile.
+Only NRX packets can wait for a node that is held up like this, and
+any more are lost as if the driver's queue had overflowed.
+Node A sends
+count datagrams to node B as fast as the window allows, and B reads
+them at once and checks that each one arrives exactly once and in
+order.  At the end, the program prints the time taken, the link
+utilisation (the fraction of the time spent carrying new data), and
+the statistics from each end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "reliable.h"
+
+#define TURNAROUND 150          /* Gap between packets (usec) */
+#define TICK 1000               /* Interval between timer ticks (usec) */
+#define PAYLOAD 100             /* Bytes of data per datagram */
+#define NTX 4                   /* Packets queued by each radio driver */
+#define NRX 5                   /* Packets held for a busy receiver */
+#define MAXQ 64                 /* Max packets not yet delivered */
+
+/* airtime -- time for a packet of n bytes at 1Mbit/s */
+static unsigned airtime(int n)
+{
+    /* Preamble, address, length, 3 byte prefix, data, CRC */
+    return 8 * (1 + 5 + 1 + 3 + n + 2);
+}
+
+static rel_conn node[2];        /* Node A and node B */
+static double drop = 0.1;       /* Probability of losing a packet */
+static int verbose = 0;
+
+/* The channel carries one packet at a time: packets queue up for it
+in order of sending, and each finishes at a known time.  A node that is
+held up in output does not see a packet until it is free again, so
+packets are delivered in order of the later of the two times. */
+
+static struct packet {
+    int src, dest;              /* Sending and receiving nodes */
+    unsigned done;              /* Time when it leaves the channel */
+    int n;                      /* Length */
+    unsigned char data[REL_HEADER+REL_MAXDATA];
+} queue[MAXQ];
+
+static int q_count = 0;
+static unsigned now = 0;        /* Simulated time (usec) */
+static unsigned busy = 0;       /* Time when channel is free */
+static unsigned held[2];        /* Time when each node is free */
+
+/* node_time -- the time as seen by a node */
+static unsigned node_time(int i)
+{
+    return (held[i] > now ? held[i] : now);
+}
+
+/* output -- put a packet on the channel */
+static void output(rel_conn *c, const unsigned char *pkt, int n)
+{
+    struct packet *p;
+    int src = (c == &node[0] ? 0 : 1);
+    unsigned t = node_time(src), start;
+
+    /* Wait while the driver has NTX packets that are not yet sent */
+    while (1) {
+        int k = 0;
+        unsigned first = 0;
+        for (int i = 0; i < q_count; i++) {
+            if (queue[i].src == src && queue[i].done > t) {
+                if (k == 0 || queue[i].done < first) first = queue[i].done;
+                k++;
+            }
+        }
+        if (k < NTX) break;
+        t = first;
+    }
+    held[src] = t;
+
+    if (q_count == MAXQ) {
+        fprintf(stderr, "relsim: channel queue overflow\n");
+        exit(1);
+    }
+
+    start = (busy > t ? busy : t);
+    p = &queue[q_count++];
+    p->src = src;
+    p->dest = 1-src;
+    p->n = n;
+    memcpy(p->data, pkt, n);
+    busy = start + airtime(n) + TURNAROUND;
+    p->done = busy;
+
+    if (verbose)
+        printf("%9u %c->%c %c seq %u\n", start, 'A'+src, 'A'+p->dest,
+               pkt[0], pkt[3] | (pkt[4] << 8));
+}
+
+/* arrival -- time when a packet is seen by its receiver */
+static unsigned arrival(struct packet *p)
+{
+    return (held[p->dest] > p->done ? held[p->dest] : p->done);
+}
+
+static void print_stats(char *name, struct rel_stats *st)
+{
+    printf("%s: sent %u resent %u timeouts %u acks %u dups %u delivered %u\n",
+           name, st->sent, st->resent, st->timeouts, st->acks,
+           st->dups, st->delivered);
+}
+
+int main(int argc, char **argv)
+{
+    int window = 8, count = 1000, seed = 1, opt;
+    int sent = 0, received = 0;
+    unsigned next_tick[2] = { TICK, TICK }, useful;
+    unsigned char buf[REL_MAXDATA];
+
+    while ((opt = getopt(argc, argv, "d:w:n:s:v")) != -1) {
+        switch (opt) {
+        case 'd': drop = atof(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 's': seed = atoi(optarg); break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "Usage: relsim [-d drop] [-w window]"
+                    " [-n count] [-s seed] [-v]\n");
+            exit(2);
+        }
+    }
+
+    srandom(seed);
+    rel_init(&node[0], 'A', 'B', window, output);
+    rel_init(&node[1], 'B', 'A', window, output);
+
+    while (received < count) {
+        /* Node A sends as much as it can */
+        while (sent < count) {
+            memset(buf, sent & 0xff, PAYLOAD);
+            memcpy(buf, &sent, sizeof(int));
+            if (! rel_send(&node[0], buf, PAYLOAD, node_time(0))) break;
+            sent++;
+        }
+
+        /* Lose packets that overflow a busy receiver's queue */
+        int waiting[2] = { 0, 0 };
+        for (int i = 0; i < q_count; ) {
+            struct packet *p = &queue[i];
+            if (p->done < held[p->dest] && ++waiting[p->dest] > NRX) {
+                if (verbose) printf("%9u overrun\n", p->done);
+                q_count--;
+                memmove(p, p+1, (q_count - i) * sizeof(struct packet));
+            } else {
+                i++;
+            }
+        }
+
+        /* Advance to the next event: the earliest delivery, or a tick
+           for a node, each delayed while the node is held up */
+        int best = -1, tk = -1;
+        unsigned when = 0;
+        for (int i = 0; i < q_count; i++) {
+            if (best < 0 || arrival(&queue[i]) < when) {
+                best = i; when = arrival(&queue[i]);
+            }
+        }
+        for (int i = 0; i < 2; i++) {
+            unsigned t = (held[i] > next_tick[i] ? held[i] : next_tick[i]);
+            if ((best < 0 && tk < 0) || t < when) {
+                best = -1; tk = i; when = t;
+            }
+        }
+
+        now = when;
+        if (best >= 0) {
+            struct packet p = queue[best];
+            q_count--;
+            memmove(&queue[best], &queue[best+1],
+                    (q_count - best) * sizeof(struct packet));
+            if ((double) random() / RAND_MAX >= drop)
+                rel_input(&node[p.dest], p.data, p.n, now);
+            else if (verbose)
+                printf("%9u dropped\n", now);
+        } else {
+            while (next_tick[tk] <= now) next_tick[tk] += TICK;
+            rel_tick(&node[tk], now);
+        }
+
+        /* Node B reads everything that has arrived */
+        int n;
+        while ((n = rel_recv(&node[1], buf)) >= 0) {
+            int k;
+            memcpy(&k, buf, sizeof(int));
+            if (n != PAYLOAD || k != received) {
+                printf("Error: expected %d, got %d (length %d)\n",
+                       received, k, n);
+                exit(1);
+            }
+            received++;
+        }
+
+        if (now > 600000000) {
+            printf("Gave up after 10 minutes\n");
+            exit(1);
+        }
+    }
+
+    useful = count * (airtime(REL_HEADER+PAYLOAD) + TURNAROUND);
+    printf("drop %.2f window %d: %d datagrams in %.3f s,"
+           " utilisation %.1f%%\n", drop, window, count, now / 1e6,
+           100.0 * useful / now);
+    print_stats("A", &node[0].stats);
+    print_stats("B", &node[1].stats);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/* x35-reliable/transfer.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+#include "reliable.h"
+
+/* Bulk transfer over a reliable link.  Load the program on two boards,
+and hold button A on one of them while it resets: that board becomes
+the sender, and the other is the receiver.  The sender sends NDATA
+datagrams as fast as the link will take them, and the receiver checks
+that they arrive in order and prints the rate and the statistics from
+the protocol. */
+
+#define GROUP 42
+#define WINDOW 8
+
+#define NDATA 1000              /* Datagrams to send */
+#define PAYLOAD 100             /* Bytes in each datagram */
+
+/* sender_task -- send a stream of numbered datagrams */
+void sender_task(int dummy)
+{
+    unsigned buf[PAYLOAD/4];
+    struct rel_stats st;
+    unsigned t0, t;
+
+    printf("Sending %d datagrams\n", NDATA);
+    t0 = timer_micros();
+    for (int i = 0; i < NDATA; i++) {
+        buf[0] = i;
+        rlink_send(buf, PAYLOAD);
+    }
+    t = timer_micros() - t0;
+
+    rlink_getstats(&st);
+    printf("Sent in %u ms: resent %u timeouts %u\n",
+           t/1000, st.resent, st.timeouts);
+}
+
+/* receiver_task -- receive and check the datagrams */
+void receiver_task(int dummy)
+{
+    unsigned buf[REL_MAXDATA/4];
+    struct rel_stats st;
+    unsigned t0 = 0, t;
+    int n;
+
+    printf("Waiting for datagrams\n");
+
+    for (int i = 0; i < NDATA; i++) {
+        n = rlink_receive(buf);
+        if (i == 0) t0 = timer_micros();
+        if (n != PAYLOAD || buf[0] != i)
+            printf("Expected %d, got %u (length %d)\n", i, buf[0], n);
+    }
+    t = timer_micros() - t0;
+
+    rlink_getstats(&st);
+    printf("Received %d datagrams in %u ms: %u kbit/s, dups %u\n",
+           NDATA, t/1000, (NDATA-1) * PAYLOAD * 8000 / t, st.dups);
+}
+
+void init(void)
+{
+    int sender;
+
+    gpio_connect(BUTTON_A);
+    sender = (gpio_in(BUTTON_A) == 0);
+
+    serial_init();
+    timer_init();
+    radio_init();
+    radio_group(GROUP);
+
+    if (sender) {
+        rlink_init('S', 'R', WINDOW);
+        start("Sender", sender_task, 0, STACK);
+    } else {
+        rlink_init('R', 'S', WINDOW);
+        start("Receiver", receiver_task, 0, STACK);
+    }
+}
@@ -0,0 +1,77 @@
+/* x36-timesync/clocks.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+
+/* Synchronised clocks.  Load the program on two or more boards, and
+hold button A on one of them while it resets: that board is the root,
+and the others follow it.  Every board pulses pin 0 at the start of
+each second of global time, so the true synchronisation error can be
+seen by connecting the pins to an oscilloscope, and the followers
+print the error that timesync measures for itself, together with the
+drift of their crystal against the root's. */
+
+#define GROUP 42
+
+#define SECOND 1000000          /* In usec */
+
+/* pulse_task -- pulse pin 0 once a second */
+void pulse_task(int dummy)
+{
+    unsigned next, now;
+
+    gpio_dir(PAD0, 1);
+    gpio_out(PAD0, 0);
+
+    while (1) {
+        now = timer_global_micros();
+        next = (now / SECOND + 1) * SECOND;
+
+        /* Sleep until just before the second, then watch closely */
+        if (next - now > 5000)
+            timer_delay((next - now - 5000) / 1000);
+        while ((int) (timer_global_micros() - next) < 0) { }
+
+        gpio_out(PAD0, 1);
+        timer_delay(10);
+        gpio_out(PAD0, 0);
+    }
+}
+
+/* report_task -- print the state of synchronisation */
+void report_task(int dummy)
+{
+    struct timesync_stats st;
+
+    timer_pulse(5000);
+
+    while (1) {
+        timer_wait();
+        timesync_getstats(&st);
+        if (! st.synced)
+            printf("Waiting for the root\n");
+        else
+            printf("%u readings: error %d us (max %d), skew %d ppm\n",
+                   st.count, st.error, st.max_error, st.skew);
+    }
+}
+
+void init(void)
+{
+    int root;
+
+    gpio_connect(BUTTON_A);
+    root = (gpio_in(BUTTON_A) == 0);
+
+    serial_init();
+    timer_init();
+    radio_init();
+    radio_group(GROUP);
+    timesync_init(root);
+
+    start("Pulse", pulse_task, 0, STACK);
+    if (! root)
+        start("Report", report_task, 0, STACK);
+}
@@ -0,0 +1,111 @@
+/* x36-timesync/fittest.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Check the estimator in microbian/syncfit.c on the host.  Each case
+simulates a local clock with a given offset and drift against a
+perfect reference, feeds the estimator readings once a period with
+some timestamp jitter, and measures the error when converting local
+times halfway between readings.  Usage:
+
+    $ fittest [-v]
+
+The program prints the worst error for each case and exits with
+status 1 if any case is outside its limit. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "syncfit.h"
+
+static int verbose = 0;
+
+/* jitter -- random error of -j to +j usec */
+static int jitter(int j)
+{
+    return (j == 0 ? 0 : random() % (2*j+1) - j);
+}
+
+/* local_time -- local clock reading at reference time t */
+static unsigned local_time(double t, unsigned start, double ppm)
+{
+    return start + (unsigned long long) (t * (1.0 + ppm / 1e6));
+}
+
+/* run -- simulate one case and return the worst error after warm-up */
+static int run(char *name, unsigned start, double ppm, int period,
+               int jit, int limit)
+{
+    struct sync_fit f;
+    int worst = 0, ppm_est;
+    double t = 0.0;
+
+    sync_init(&f);
+
+    for (int k = 0; k < 50; k++) {
+        /* A reading at reference time t */
+        unsigned ref = (unsigned) t + jitter(jit);
+        unsigned loc = local_time(t, start, ppm) + jitter(jit);
+        sync_add(&f, loc, ref);
+
+        /* Check a conversion halfway to the next reading */
+        if (k >= SYNC_NPOINTS) {
+            double tm = t + period / 2;
+            int err = sync_global(&f, local_time(tm, start, ppm))
+                - (unsigned) tm;
+            if (err < 0) err = -err;
+            if (err > worst) worst = err;
+            if (verbose) printf("  %2d: error %d\n", k, err);
+        }
+
+        t += period;
+    }
+
+    ppm_est = sync_ppm(&f);
+    printf("%-24s worst error %3d us, skew %4d ppm: %s\n",
+           name, worst, ppm_est, (worst <= limit ? "ok" : "FAIL"));
+    return worst <= limit;
+}
+
+/* run_jump -- check that a jump in the reference restarts the fit */
+static int run_jump(void)
+{
+    struct sync_fit f;
+    unsigned t = 0;
+    int err;
+
+    sync_init(&f);
+    for (int k = 0; k < 20; k++, t += 1000000)
+        sync_add(&f, t + 5000, t);
+
+    /* The reference is reset by a second */
+    for (int k = 0; k < 3; k++, t += 1000000)
+        sync_add(&f, t + 5000, t - 1000000);
+
+    err = sync_global(&f, t + 5000) - (t - 1000000);
+    printf("%-24s error %3d us: %s\n", "reference jump", err,
+           (err == 0 ? "ok" : "FAIL"));
+    return err == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int ok = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+    srandom(1);
+
+    ok &= run("same clock", 0, 0.0, 1000000, 0, 0);
+    ok &= run("offset only", 123456, 0.0, 1000000, 0, 0);
+    ok &= run("fast 40ppm", 5000, 40.0, 1000000, 0, 1);
+    ok &= run("slow 40ppm", 5000, -40.0, 1000000, 0, 1);
+    ok &= run("fast 40ppm, jitter 1us", 5000, 40.0, 1000000, 1, 3);
+    ok &= run("slow 25ppm, jitter 2us", 5000, -25.0, 1000000, 2, 5);
+    ok &= run("wrap around", 0xfff00000, 30.0, 1000000, 1, 3);
+    ok &= run("short period", 777, 50.0, 100000, 1, 3);
+    ok &= run("15s gaps, fast 60ppm", 4321, 60.0, 15000000, 1, 3);
+    ok &= run("30s gaps, slow 30ppm", 4321, -30.0, 30000000, 1, 3);
+    ok &= run_jump();
+
+    printf("%s\n", (ok ? "All passed" : "Some cases FAILED"));
+    return (ok ? 0 : 1);
+}
@@ -0,0 +1,100 @@
+/* x37-mesh/meshdemo.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+#include "mesh.h"
+#include <string.h>
+
+/* A mesh of boards.  Load the program on several boards and spread
+them out so that not all of them can hear each other.  Pressing button
+A on any board floods a greeting to all the others; pressing button B
+sends a ping by the routed path to the board that last sent a greeting,
+and that board answers.  Every board prints what it receives, with
+the counters kept by the protocol. */
+
+#define GROUP 42
+
+/* Messages start with a letter saying what they are */
+#define MSG_HELLO 'H'
+#define MSG_PING 'P'
+#define MSG_ECHO 'E'
+
+static int last_src = -1;       /* Sender of the last greeting */
+
+/* receiver_task -- print messages and answer pings */
+void receiver_task(int dummy)
+{
+    char buf[MESH_MAXDATA+1];
+    struct mesh_stats st;
+    int n, src;
+
+    printf("Node %x ready\n", meshnet_id());
+
+    while (1) {
+        n = meshnet_receive(buf, &src);
+        buf[n] = '\0';
+
+        switch (buf[0]) {
+        case MSG_HELLO:
+            last_src = src;
+            break;
+        case MSG_PING:
+            buf[0] = MSG_ECHO;
+            meshnet_send(src, buf, n);
+            break;
+        }
+
+        meshnet_getstats(&st);
+        printf("From %x: %s (sent %u fwd %u dup %u supp %u drop %u)\n",
+               src, buf, st.sent, st.forwarded, st.duplicates,
+               st.suppressed, st.dropped);
+    }
+}
+
+/* button_task -- send messages when the buttons are pressed */
+void button_task(int dummy)
+{
+    char buf[32];
+    int count = 0;
+
+    gpio_connect(BUTTON_A);
+    gpio_connect(BUTTON_B);
+
+    while (1) {
+        if (gpio_in(BUTTON_A) == 0) {
+            sprintf(buf, "%chello %d from %x",
+                    MSG_HELLO, count++, meshnet_id());
+            meshnet_send(MESH_BROADCAST, buf, strlen(buf));
+            timer_delay(500);
+        } else if (gpio_in(BUTTON_B) == 0) {
+            if (last_src < 0)
+                printf("Nobody to ping yet\n");
+            else {
+                sprintf(buf, "%cping %d from %x",
+                        MSG_PING, count++, meshnet_id());
+                if (! meshnet_send(last_src, buf, strlen(buf)))
+                    printf("No route to %x\n", last_src);
+                else
+                    printf("Ping to %x via %x\n", last_src,
+                           meshnet_route(last_src));
+            }
+            timer_delay(500);
+        }
+
+        timer_delay(100);
+    }
+}
+
+void init(void)
+{
+    serial_init();
+    timer_init();
+    radio_init();
+    radio_group(GROUP);
+    meshnet_init();
+
+    start("Receiver", receiver_task, 0, STACK);
+    start("Buttons", button_task, 0, STACK);
+}
@@ -0,0 +1,428 @@
+/* x37-mesh/meshsim.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Discrete-event simulation of a network of nodes running the mesh
+protocol in microbian/mesh.c.  Usage:
+
+    $ meshsim [-n nodes] [-t line|grid|random] [-r radius] [-l loss]
+              [-m messages] [-u unicast] [-i interval] [-s seed] [-v]
+
+Nodes are placed in a line, a square grid, or at random in a unit
+square, where two nodes can hear each other if they are closer than
+radius.  Each packet occupies the channel for its airtime at 1Mbit/s.
+As with the real radio, a node cannot receive while it is sending,
+and two packets that overlap at a receiver are both lost; on top of
+that, each reception is lost with probability loss.  After the routes
+have had WARMUP to settle, random nodes send messages at intervals of
+interval ms, a fraction unicast of them to a random node and the rest
+flooded to all.  The program prints the delivery ratio and latency
+for each kind, counting only nodes that can be reached within the
+hop limit, and totals of the counters kept by the nodes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "mesh.h"
+
+#define MAXN 100                /* Max nodes */
+#define MAXMSG 10000            /* Max messages */
+#define MAXTX 4096              /* Max transmissions in progress */
+#define MAXEV 65536             /* Max pending events */
+
+#define TICK 1000               /* Interval between mesh_tick (usec) */
+#define WARMUP 5000000          /* Time for routes to settle (usec) */
+#define DRAIN 2000000           /* Time after last message (usec) */
+#define TURNAROUND 150          /* Gap between packets from a node */
+#define PAYLOAD 20              /* Bytes of data in each message */
+
+static int nnodes = 16;
+static double loss = 0.05;
+static int verbose = 0;
+
+static mesh_node node[MAXN];
+static char hears[MAXN][MAXN];   /* Whether two nodes can hear each other */
+static unsigned now = 0;        /* Simulated time */
+
+/* node_id -- address of a node, as if from the FICR */
+#define node_id(i) (0x100 + (i))
+
+/* uniform -- random number in [0, 1) */
+static double uniform(void)
+{
+    return (double) random() / ((double) RAND_MAX + 1.0);
+}
+
+
+/* TOPOLOGY */
+
+/* make_links -- set up the links for a topology */
+static void make_links(char *topo, double radius)
+{
+    double x[MAXN], y[MAXN];
+    int side = (int) ceil(sqrt(nnodes));
+
+    for (int i = 0; i < nnodes; i++) {
+        if (strcmp(topo, "line") == 0) {
+            x[i] = i; y[i] = 0;
+            radius = 1.5;
+        } else if (strcmp(topo, "grid") == 0) {
+            x[i] = i % side; y[i] = i / side;
+            radius = 1.5;       /* Diagonal neighbours too */
+        } else if (strcmp(topo, "random") == 0) {
+            x[i] = uniform(); y[i] = uniform();
+        } else {
+            fprintf(stderr, "meshsim: unknown topology %s\n", topo);
+            exit(2);
+        }
+    }
+
+    for (int i = 0; i < nnodes; i++) {
+        for (int j = 0; j < nnodes; j++) {
+            double dx = x[i] - x[j], dy = y[i] - y[j];
+            hears[i][j] = (i != j && dx*dx + dy*dy < radius*radius);
+        }
+    }
+}
+
+/* distances -- find hop counts from a node, or -1 if unreachable */
+static void distances(int src, int dist[])
+{
+    int queue[MAXN], head = 0, tail = 0;
+
+    for (int i = 0; i < nnodes; i++) dist[i] = -1;
+    dist[src] = 0; queue[tail++] = src;
+    while (head < tail) {
+        int u = queue[head++];
+        for (int v = 0; v < nnodes; v++) {
+            if (hears[u][v] && dist[v] < 0) {
+                dist[v] = dist[u]+1; queue[tail++] = v;
+            }
+        }
+    }
+}
+
+/* reachable -- test if a packet can get from src to dst within the TTL */
+static int reachable(int src, int dst)
+{
+    int dist[MAXN];
+    distances(src, dist);
+    return (dist[dst] > 0 && dist[dst] <= MESH_TTL);
+}
+
+
+/* EVENTS */
+
+#define EV_TICK 1               /* Call mesh_tick for every node */
+#define EV_START 2              /* Transmission starts */
+#define EV_END 3                /* Transmission ends */
+#define EV_MSG 4                /* A node sends a message */
+
+static struct event {
+    unsigned time;
+    int type, arg;
+    unsigned order;             /* Tie-breaker to keep events in order */
+} heap[MAXEV];
+
+static int nevents = 0;
+static unsigned ev_count = 0;
+
+/* earlier -- compare two events */
+static int earlier(struct event *a, struct event *b)
+{
+    if (a->time != b->time) return a->time < b->time;
+    return a->order < b->order;
+}
+
+/* schedule -- add an event to the heap */
+static void schedule(unsigned time, int type, int arg)
+{
+    int i = nevents++;
+
+    if (nevents > MAXEV) {
+        fprintf(stderr, "meshsim: too many events\n");
+        exit(1);
+    }
+
+    heap[i].time = time; heap[i].type = type;
+    heap[i].arg = arg; heap[i].order = ev_count++;
+    while (i > 0 && earlier(&heap[i], &heap[(i-1)/2])) {
+        struct event t = heap[i];
+        heap[i] = heap[(i-1)/2]; heap[(i-1)/2] = t;
+        i = (i-1)/2;
+    }
+}
+
+/* next_event -- remove the earliest event from the heap */
+static struct event next_event(void)
+{
+    struct event e = heap[0];
+    int i = 0;
+
+    heap[0] = heap[--nevents];
+    while (1) {
+        int c = 2*i+1;
+        if (c >= nevents) break;
+        if (c+1 < nevents && earlier(&heap[c+1], &heap[c])) c++;
+        if (! earlier(&heap[c], &heap[i])) break;
+        struct event t = heap[i];
+        heap[i] = heap[c]; heap[c] = t;
+        i = c;
+    }
+
+    return e;
+}
+
+
+/* CHANNEL */
+
+/* A transmission is heard by every neighbour of the sender.  Each node
+keeps the reception that ends last, so that an overlapping one can
+spoil it. */
+
+static struct tx {
+    int sender;
+    unsigned end;
+    int n;
+    unsigned char pkt[MESH_MAXPACKET];
+    char ok[MAXN];              /* Whether each node receives it */
+} txs[MAXTX];
+
+static int tx_next = 0;
+
+static unsigned tx_free[MAXN];  /* When each node's radio is free */
+static unsigned tx_busy[MAXN];  /* End of current transmission */
+static unsigned rx_end[MAXN];   /* End of latest reception at each node */
+static int rx_tx[MAXN];         /* Which transmission that is */
+
+/* airtime -- time for a packet of n bytes at 1Mbit/s */
+static unsigned airtime(int n)
+{
+    /* Preamble, address, length, 3 byte prefix, data, CRC */
+    return 8 * (1 + 5 + 1 + 3 + n + 2);
+}
+
+/* output -- the mesh layer sends a packet */
+static void output(mesh_node *m, const unsigned char *pkt, int n)
+{
+    int i = m - node, k = tx_next;
+    unsigned start = (tx_free[i] > now ? tx_free[i] : now);
+    struct tx *t = &txs[k];
+
+    tx_next = (tx_next+1) % MAXTX;
+    t->sender = i;
+    t->end = start + airtime(n);
+    t->n = n;
+    memcpy(t->pkt, pkt, n);
+    tx_free[i] = t->end + TURNAROUND;
+    schedule(start, EV_START, k);
+}
+
+/* tx_start -- a transmission begins */
+static void tx_start(int k)
+{
+    struct tx *t = &txs[k];
+    int s = t->sender;
+
+    /* The sender stops receiving */
+    if (rx_end[s] > now) txs[rx_tx[s]].ok[s] = 0;
+    tx_busy[s] = t->end;
+
+    for (int r = 0; r < nnodes; r++) {
+        t->ok[r] = hears[s][r];
+        if (! t->ok[r]) continue;
+
+        if (tx_busy[r] > now) {
+            /* The receiver is busy sending */
+            t->ok[r] = 0;
+        }
+
+        if (rx_end[r] > now) {
+            /* Collision */
+            txs[rx_tx[r]].ok[r] = 0;
+            t->ok[r] = 0;
+        }
+
+        if (t->end > rx_end[r]) {
+            rx_end[r] = t->end;
+            rx_tx[r] = k;
+        }
+    }
+
+    schedule(t->end, EV_END, k);
+}
+
+/* tx_end -- a transmission finishes and is received */
+static void tx_end(int k)
+{
+    struct tx *t = &txs[k];
+
+    for (int r = 0; r < nnodes; r++) {
+        if (t->ok[r] && uniform() >= loss)
+            mesh_input(&node[r], t->pkt, t->n, now);
+    }
+}
+
+
+/* MESSAGES */
+
+static struct msg {
+    int src, dst;               /* Nodes, or dst = -1 for flooding */
+    unsigned sent;              /* Time sent */
+    int expected;               /* Reachable receivers */
+    int received;               /* Receivers so far */
+} msgs[MAXMSG];
+
+static int nmsgs = 0;
+
+static double lat_sum[2], lat_max[2], hop_sum[2];
+static int got[2], want[2];
+
+/* deliver -- the mesh layer delivers a message */
+static void deliver(mesh_node *m, int src, int hops,
+                    const unsigned char *data, int n)
+{
+    int id, uni;
+    double lat;
+
+    memcpy(&id, data, sizeof(int));
+    if (id < 0 || id >= nmsgs) return;
+    uni = (msgs[id].dst >= 0);
+    lat = (now - msgs[id].sent) / 1000.0;
+    msgs[id].received++;
+    got[uni]++;
+    lat_sum[uni] += lat;
+    hop_sum[uni] += hops;
+    if (lat > lat_max[uni]) lat_max[uni] = lat;
+
+    if (verbose)
+        printf("%9u node %d got message %d from %d after %d hops\n",
+               now, (int) (m - node), id, msgs[id].src, hops);
+}
+
+/* send_msg -- a random node sends a message */
+static void send_msg(double unicast)
+{
+    int id = nmsgs++, src = random() % nnodes, dst = -1;
+    unsigned char buf[PAYLOAD];
+
+    if (uniform() < unicast) {
+        do dst = random() % nnodes; while (dst == src);
+    }
+
+    msgs[id].src = src;
+    msgs[id].dst = dst;
+    msgs[id].sent = now;
+    msgs[id].received = 0;
+    if (dst >= 0)
+        msgs[id].expected = reachable(src, dst);
+    else {
+        msgs[id].expected = 0;
+        for (int i = 0; i < nnodes; i++)
+            msgs[id].expected += reachable(src, i);
+    }
+    want[dst >= 0] += msgs[id].expected;
+
+    memset(buf, 0, PAYLOAD);
+    memcpy(buf, &id, sizeof(int));
+    mesh_send(&node[src], (dst < 0 ? MESH_BROADCAST : node_id(dst)),
+              buf, PAYLOAD);
+}
+
+static void report(char *kind, int uni)
+{
+    if (want[uni] == 0) return;
+    printf("%-8s delivered %5.1f%%, latency mean %.2f ms, max %.2f ms,"
+           " mean hops %.2f\n", kind, 100.0 * got[uni] / want[uni],
+           (got[uni] ? lat_sum[uni] / got[uni] : 0.0), lat_max[uni],
+           (got[uni] ? hop_sum[uni] / got[uni] : 0.0));
+}
+
+int main(int argc, char **argv)
+{
+    char *topo = "grid";
+    double radius = 0.35, unicast = 0.5;
+    int count = 200, interval = 50, seed = 1, opt;
+    unsigned finish;
+    struct mesh_stats total;
+
+    while ((opt = getopt(argc, argv, "n:t:r:l:m:u:i:s:v")) != -1) {
+        switch (opt) {
+        case 'n': nnodes = atoi(optarg); break;
+        case 't': topo = optarg; break;
+        case 'r': radius = atof(optarg); break;
+        case 'l': loss = atof(optarg); break;
+        case 'm': count = atoi(optarg); break;
+        case 'u': unicast = atof(optarg); break;
+        case 'i': interval = atoi(optarg); break;
+        case 's': seed = atoi(optarg); break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "Usage: meshsim [-n nodes] [-t line|grid|random]"
+                    " [-r radius] [-l loss] [-m messages] [-u unicast]"
+                    " [-i interval] [-s seed] [-v]\n");
+            exit(2);
+        }
+    }
+
+    if (nnodes < 2 || nnodes > MAXN || count > MAXMSG) {
+        fprintf(stderr, "meshsim: bad parameters\n");
+        exit(2);
+    }
+
+    srandom(seed);
+    make_links(topo, radius);
+
+    for (int i = 0; i < nnodes; i++)
+        mesh_init(&node[i], node_id(i), random(), output, deliver);
+
+    schedule(TICK, EV_TICK, 0);
+    for (int k = 0; k < count; k++)
+        schedule(WARMUP + k * interval * 1000, EV_MSG, 0);
+    finish = WARMUP + count * interval * 1000 + DRAIN;
+
+    while (nevents > 0) {
+        struct event e = next_event();
+        now = e.time;
+        if (now > finish) break;
+
+        switch (e.type) {
+        case EV_TICK:
+            for (int i = 0; i < nnodes; i++)
+                mesh_tick(&node[i], now);
+            schedule(now + TICK, EV_TICK, 0);
+            break;
+        case EV_START:
+            tx_start(e.arg);
+            break;
+        case EV_END:
+            tx_end(e.arg);
+            break;
+        case EV_MSG:
+            send_msg(unicast);
+            break;
+        }
+    }
+
+    printf("%d nodes, %s topology, loss %.2f, %d messages\n",
+           nnodes, topo, loss, count);
+    report("flood", 0);
+    report("unicast", 1);
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < nnodes; i++) {
+        total.sent += node[i].stats.sent;
+        total.delivered += node[i].stats.delivered;
+        total.forwarded += node[i].stats.forwarded;
+        total.duplicates += node[i].stats.duplicates;
+        total.suppressed += node[i].stats.suppressed;
+        total.dropped += node[i].stats.dropped;
+    }
+    printf("Totals: sent %u delivered %u forwarded %u duplicates %u"
+           " suppressed %u dropped %u\n", total.sent, total.delivered,
+           total.forwarded, total.duplicates, total.suppressed,
+           total.dropped);
+
+    return 0;
+}
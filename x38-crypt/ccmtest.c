@@ -0,0 +1,214 @@
+/* x38-crypt/ccmtest.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+/* Check the nonce, counter and replay handling in microbian/ccmlink.c
+on the host.  The CCM peripheral reads its key and nonce from a
+structure in RAM, so getting a byte in the wrong place would make
+every packet fail to decrypt, or worse, reuse a nonce.  The nonce
+tests compare what ccmlink.c produces with the bytes expected from the
+layout given in the nRF52833 datasheet.  Usage:
+
+    $ ccmtest
+
+The program prints each failure and exits with status 1 if there are
+any. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "ccmlink.h"
+
+static int failures = 0;
+
+/* check_bytes -- compare n bytes with what is expected */
+static void check_bytes(char *what, const unsigned char *got,
+                        const unsigned char *want, int n)
+{
+    if (memcmp(got, want, n) == 0) return;
+
+    printf("%s: got", what);
+    for (int i = 0; i < n; i++) printf(" %02x", got[i]);
+    printf(", want");
+    for (int i = 0; i < n; i++) printf(" %02x", want[i]);
+    printf("\n");
+    failures++;
+}
+
+/* check -- test a condition */
+static void check(char *what, int ok)
+{
+    if (ok) return;
+    printf("%s: failed\n", what);
+    failures++;
+}
+
+/* The CCM reads the key at offset 0, the packet counter at 16, the
+   direction bit at 24 and the IV at 25, 33 bytes in all */
+static void test_layout(void)
+{
+    check("size of ccm_cnf", sizeof(struct ccm_cnf) == 33);
+    check("offset of key", offsetof(struct ccm_cnf, key) == 0);
+    check("offset of pktctr", offsetof(struct ccm_cnf, pktctr) == 16);
+    check("offset of direction", offsetof(struct ccm_cnf, direction) == 24);
+    check("offset of iv", offsetof(struct ccm_cnf, iv) == 25);
+}
+
+/* Nonces for a few senders, counters, groups and protocols */
+static const struct {
+    unsigned src, ctr, group, proto;
+    unsigned char cnf[33];
+} nonces[] = {
+    { 0x0000, 0x00000000, 0x00, 0x00,
+      { 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+        0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { 0x1234, 0x89abcdef, 0x2a, 0x05,
+      { 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+        0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+        0xef, 0xcd, 0xab, 0x89, 0x00, 0x00, 0x00, 0x00,
+        0x00,
+        0x34, 0x12, 0x2a, 0x05, 0x00, 0x00, 0x00, 0x00 } },
+    { 0xfffe, 0xffffffff, 0xff, 0x7f,
+      { 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+        0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+        0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+        0x00,
+        0xfe, 0xff, 0xff, 0x7f, 0x00, 0x00, 0x00, 0x00 } }
+};
+
+#define NNONCES (sizeof(nonces) / sizeof(nonces[0]))
+
+static void test_nonces(void)
+{
+    unsigned char key[16];
+    struct ccm_cnf c;
+    char what[40];
+
+    for (int i = 0; i < 16; i++) key[i] = 0xc0 + i;
+    ccm_setkey(&c, key);
+
+    /* Fill the nonce with junk to make sure it is all overwritten */
+    memset(c.pktctr, 0x55, 8);
+    c.direction = 1;
+    memset(c.iv, 0x55, 8);
+
+    for (int i = 0; i < NNONCES; i++) {
+        ccm_nonce(&c, nonces[i].src, nonces[i].ctr,
+                  nonces[i].group, nonces[i].proto);
+        sprintf(what, "nonce %04x/%08x/%02x/%02x", nonces[i].src,
+                nonces[i].ctr, nonces[i].group, nonces[i].proto);
+        check_bytes(what, (unsigned char *) &c, nonces[i].cnf, 33);
+    }
+}
+
+/* The clear header is src then ctr, both little-endian */
+static void test_header(void)
+{
+    static const unsigned char want[CCM_CLEAR] =
+        { 0x34, 0x12, 0xef, 0xcd, 0xab, 0x89 };
+    unsigned char buf[CCM_CLEAR+2];
+    unsigned src, ctr;
+
+    memset(buf, 0xaa, sizeof(buf));
+    ccm_put_header(buf, 0x1234, 0x89abcdef);
+    check_bytes("header", buf, want, CCM_CLEAR);
+    check("header overrun", buf[CCM_CLEAR] == 0xaa);
+
+    ccm_get_header(buf, &src, &ctr);
+    check("header src", src == 0x1234);
+    check("header ctr", ctr == 0x89abcdef);
+
+    /* Top bits must not be sign-extended */
+    ccm_put_header(buf, 0xffff, 0xffffffff);
+    ccm_get_header(buf, &src, &ctr);
+    check("header all ones", src == 0xffff && ctr == 0xffffffff);
+}
+
+/* The counter counts up from its start, wraps around at 2^32, and
+   stops when it would come back to the start */
+static void test_counter(void)
+{
+    struct ccm_counter k;
+    unsigned ctr = 0;
+
+    ccm_counter_init(&k, 0xfffffffe);
+    check("counter first", ccm_counter_next(&k, &ctr) && ctr == 0xfffffffe);
+    check("counter second", ccm_counter_next(&k, &ctr) && ctr == 0xffffffff);
+    check("counter wraps", ccm_counter_next(&k, &ctr) && ctr == 0);
+    check("counter after wrap", ccm_counter_next(&k, &ctr) && ctr == 1);
+
+    /* Pretend all but one value have been used */
+    ccm_counter_init(&k, 5);
+    k.next = 4;
+    check("counter last", ccm_counter_next(&k, &ctr) && ctr == 4);
+    check("counter exhausted", ! ccm_counter_next(&k, &ctr));
+    check("counter stays exhausted", ! ccm_counter_next(&k, &ctr));
+
+    /* A fresh counter is not exhausted at once, even from zero */
+    ccm_counter_init(&k, 0);
+    check("counter from zero", ccm_counter_next(&k, &ctr) && ctr == 0);
+}
+
+/* Each sender's counter must increase, even across a wrap, and the
+   sender heard from least recently is forgotten when the table fills */
+static void test_replay(void)
+{
+    struct ccm_replay r;
+
+    ccm_replay_init(&r);
+    check("replay first", ccm_replay_check(&r, 0x1234, 100));
+    check("replay same", ! ccm_replay_check(&r, 0x1234, 100));
+    check("replay older", ! ccm_replay_check(&r, 0x1234, 99));
+    check("replay newer", ccm_replay_check(&r, 0x1234, 105));
+    check("replay skipped", ! ccm_replay_check(&r, 0x1234, 101));
+    check("replay other sender", ccm_replay_check(&r, 0x5678, 50));
+    check("replay senders apart", ccm_replay_check(&r, 0x1234, 106));
+
+    ccm_replay_init(&r);
+    check("replay before wrap", ccm_replay_check(&r, 1, 0xffffffff));
+    check("replay after wrap", ccm_replay_check(&r, 1, 0));
+    check("replay across wrap", ! ccm_replay_check(&r, 1, 0xfffffffe));
+
+    /* Fill the table, then hear again from sender 0 */
+    ccm_replay_init(&r);
+    for (int i = 0; i < CCM_NSENDERS; i++)
+        ccm_replay_check(&r, i, 10);
+    check("replay refresh", ccm_replay_check(&r, 0, 11));
+
+    /* A new sender pushes out sender 1, but not sender 0 */
+    check("replay new sender", ccm_replay_check(&r, 100, 10));
+    check("replay kept", ! ccm_replay_check(&r, 0, 11));
+    check("replay forgotten", ccm_replay_check(&r, 1, 10));
+    check("replay table size", r.nsenders == CCM_NSENDERS);
+
+    /* Starting again forgets everything */
+    ccm_replay_init(&r);
+    check("replay after init", ccm_replay_check(&r, 0, 11));
+}
+
+/* The overhead is the clear header, H, L, RFU and the MIC */
+static void test_lengths(void)
+{
+    check("overhead", CCM_OVERHEAD == 13);
+}
+
+int main(int argc, char **argv)
+{
+    test_layout();
+    test_nonces();
+    test_header();
+    test_counter();
+    test_replay();
+    test_lengths();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        exit(1);
+    }
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+/* x38-crypt/secret.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+#include <string.h>
+
+/* Encrypted radio messages.  Load the program on two or more boards;
+pressing button A on any of them sends a numbered message, encrypted
+with a shared key, and the others print it.  A board that has button B
+held while it resets uses the wrong key: its messages are not accepted
+by the others, and the radio counts them as authentication errors,
+which each board prints along with each message it receives. */
+
+#define GROUP 42
+
+static const byte key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+static int wrong = 0;           /* Whether to use the wrong key */
+
+/* receiver_task -- set the key, then print messages as they arrive */
+void receiver_task(int dummy)
+{
+    char buf[RADIO_PACKET+1];
+    struct radio_stats st;
+    byte wrong_key[16];
+    int n;
+
+    if (! wrong)
+        radio_encrypt(key);
+    else {
+        /* Flip one bit of the key */
+        memcpy(wrong_key, key, 16);
+        wrong_key[0] ^= 1;
+        radio_encrypt(wrong_key);
+        printf("Using the wrong key\n");
+    }
+
+    while (1) {
+        n = radio_receive(buf);
+        buf[n] = '\0';
+        radio_getstats(&st);
+        printf("Received: %s (auth errors %u, replays %u)\n",
+               buf, st.auth_errors, st.replays);
+    }
+}
+
+/* sender_task -- send a message when button A is pressed */
+void sender_task(int dummy)
+{
+    char buf[32];
+    int count = 0;
+
+    gpio_connect(BUTTON_A);
+
+    while (1) {
+        if (gpio_in(BUTTON_A) == 0) {
+            sprintf(buf, "Secret message %d", count++);
+            radio_send(buf, strlen(buf));
+            printf("Sent: %s\n", buf);
+            timer_delay(500);
+        }
+
+        timer_delay(100);
+    }
+}
+
+void init(void)
+{
+    gpio_connect(BUTTON_B);
+    wrong = (gpio_in(BUTTON_B) == 0);
+
+    serial_init();
+    timer_init();
+    radio_init();
+    radio_group(GROUP);
+
+    start("Receiver", receiver_task, 0, STACK);
+    start("Sender", sender_task, 0, STACK);
+}
@@ -0,0 +1,117 @@
+/* x39-display/dispbench.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+
+/* Measure what it costs to keep the display refreshed.  A process at
+low priority counts as fast as it can, and a benchmark process reads
+the count once a second, first with the display switched off, then
+with the interrupt-driven refresh in display.c, and finally with the
+old scheme where a high-priority process wakes every 3ms to show the
+next row.  The loss of counts compared with the first line is the CPU
+time taken by refresh.  The jitter column is the worst delay between
+the moment a row was due and the moment it appeared. */
+
+#define NSECS 5                 /* Seconds for each measurement */
+
+#define GO 16                   /* Message to start the old scheme */
+
+static int SCAN;
+
+static volatile unsigned count = 0;
+
+static unsigned scan_jitter = 0;
+
+/* heart -- filled-in heart image */
+const unsigned heart[] =
+    IMAGE(0,1,0,1,0,
+          1,1,1,1,1,
+          1,1,1,1,1,
+          0,1,1,1,0,
+          0,0,1,0,0);
+
+/* spin_task -- count as fast as possible */
+void spin_task(int dummy)
+{
+    while (1) count++;
+}
+
+/* scan_task -- refresh the display in the old way, using a process */
+void scan_task(int dummy)
+{
+    unsigned next, now, late;
+    int n = 0;
+
+    priority(P_HIGH);
+    receive(GO, NULL);
+    timer_pulse(3);
+    next = timer_micros() + 3000;
+
+    while (1) {
+        receive(PING, NULL);
+        now = timer_micros();
+        late = now - next;
+        if ((int) late > 0 && late > scan_jitter) scan_jitter = late;
+        next += 3000;
+
+        GPIO0.OUTCLR = LED_MASK0;
+        GPIO1.OUTCLR = LED_MASK1;
+        GPIO1.OUTSET = heart[n+1];
+        GPIO0.OUTSET = heart[n];
+        n += 2;
+        if (n == 10) n = 0;
+    }
+}
+
+/* measure -- return average counts per second over NSECS seconds */
+unsigned measure(void)
+{
+    unsigned start;
+
+    timer_delay(1000);          /* Let things settle */
+    start = count;
+    timer_delay(1000 * NSECS);
+    return (count - start) / NSECS;
+}
+
+/* bench_task -- run the measurements */
+void bench_task(int dummy)
+{
+    unsigned base, rate;
+
+    priority(P_HIGH);
+    display_show(heart);
+
+    printf("\nDisplay refresh benchmark\n");
+    printf("%-10s %10s %6s %8s\n", "Method", "Counts/s", "Loss", "Jitter");
+
+    disable_irq(TIMER4_IRQ);
+    base = measure();
+    printf("%-10s %10u %6s %8s\n", "None", base, "-", "-");
+
+    enable_irq(TIMER4_IRQ);
+    display_latency();
+    rate = measure();
+    printf("%-10s %10u %5u%% %6uus\n", "Interrupt", rate,
+           100 - rate / (base/100), display_latency());
+
+    disable_irq(TIMER4_IRQ);
+    send(SCAN, GO, NULL);
+    rate = measure();
+    printf("%-10s %10u %5u%% %6uus\n", "Process", rate,
+           100 - rate / (base/100), scan_jitter);
+
+    while (1) receive(ANY, NULL);
+}
+
+void init(void)
+{
+    serial_init();
+    timer_init();
+    display_init();
+    start("Bench", bench_task, 0, STACK);
+    SCAN = start("Scan", scan_task, 0, STACK);
+    start("Spin", spin_task, 0, STACK);
+}
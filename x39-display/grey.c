@@ -0,0 +1,48 @@
+/* x39-display/grey.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+
+/* A ripple of brightness that spreads from the centre of the display,
+using all sixteen levels of greyscale.  The animation is paced by the
+display itself, with a new picture every few frames. */
+
+#define FRAMES 3                /* Display frames per step */
+
+/* ripple -- brightness at distance d from the centre after t steps */
+static int ripple(int d, int t)
+{
+    int v = (t - 3*d) % 30;
+    if (v < 0) v += 30;
+    return (v < 15 ? v : 29 - v);
+}
+
+/* ripple_task -- animate the ripple */
+void ripple_task(int dummy)
+{
+    byte px[25];
+    int x, y, dx, dy, i, t = 0;
+
+    while (1) {
+        for (y = 0; y < 5; y++) {
+            for (x = 0; x < 5; x++) {
+                dx = x-2; dy = y-2;
+                px[5*y+x] = ripple(dx*dx + dy*dy, t);
+            }
+        }
+
+        display_show_grey(px);
+        t++;
+
+        for (i = 0; i < FRAMES; i++)
+            display_vsync();
+    }
+}
+
+void init(void)
+{
+    display_init();
+    start("Ripple", ripple_task, 0, STACK);
+}
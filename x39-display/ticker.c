@@ -0,0 +1,45 @@
+/* x39-display/ticker.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+
+/* Scroll a message on the display, then keep showing how long the
+board has been running.  Pressing button A scrolls the greeting
+again, replacing whatever was scrolling before. */
+
+#define SPEED 90                /* Milliseconds per column */
+
+static const char *greeting = "Hello, world!";
+
+/* ticker_task -- scroll a message now and then */
+void ticker_task(int dummy)
+{
+    char buf[32];
+    int count = 0;
+
+    gpio_connect(BUTTON_A);
+    display_scroll(greeting, SPEED);
+
+    while (1) {
+        timer_delay(100);
+
+        if (gpio_in(BUTTON_A) == 0) {
+            display_scroll(greeting, SPEED);
+            count = 0;
+        } else if (++count == 100) {
+            sprintf(buf, "Up %us", timer_now() / 1000);
+            display_scroll(buf, SPEED);
+            count = 0;
+        }
+    }
+}
+
+void init(void)
+{
+    timer_init();
+    display_init();
+    scroll_init();
+    start("Ticker", ticker_task, 0, STACK);
+}
@@ -0,0 +1,131 @@
+/* x40-pixels/pixbench.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+#include "pixel.h"
+
+/* Time each stage of the pixel pipeline with the cycle counter, and
+print the cost in cycles per pixel.  For comparison, the first line
+times the approach of x13-neopixels/rainbow2.c, which works out the
+colour of each pixel from scratch with multiplications every frame.
+Each test is run NREP times with interrupts off, and the fastest run
+is reported, to exclude time lost to other processes. */
+
+#define NPIX 256                /* Pixels in the test frame */
+#define NREP 10                 /* Runs of each test */
+
+static unsigned frame[NPIX], out[NPIX];
+
+/* rgb -- assemble a colour from RGB components */
+static unsigned rgb(unsigned r, unsigned g, unsigned b)
+{
+    return PIX_RGB(r, g, b);
+}
+
+#define ISTEP 32                /* Number of steps between two colours */
+
+/* interp -- interpolate between two colours, as in rainbow2.c */
+static unsigned interp(int i, unsigned x, unsigned y)
+{
+    int r = (ISTEP-i) * PIX_R(x) + i * PIX_R(y);
+    int g = (ISTEP-i) * PIX_G(x) + i * PIX_G(y);
+    int b = (ISTEP-i) * PIX_B(x) + i * PIX_B(y);
+    return rgb(r>>5, g>>5, b>>5);
+}
+
+#define INTEN 31
+
+/* hue -- find colour on cyclic colour triangle, as in rainbow2.c */
+static unsigned hue(int i)
+{
+    int j = i & 0x1f;
+
+    switch ((i >> 5) % 3) {
+    case 0:
+        return interp(j, rgb(INTEN, 0, 0), rgb(0, INTEN, 0));
+    case 1:
+        return interp(j, rgb(0, INTEN, 0), rgb(0, 0, INTEN));
+    case 2:
+        return interp(j, rgb(0, 0, INTEN), rgb(INTEN, 0, 0));
+    default:
+        return 0;
+    }
+}
+
+/* Tests */
+#define T_OLD 0
+#define T_RAINBOW 1
+#define T_GRADIENT 2
+#define T_ROTATE 3
+#define T_FADE 4
+#define T_RENDER 5
+#define NTESTS 6
+
+static const char *name[NTESTS] = {
+    "Old hue", "Rainbow", "Gradient", "Rotate", "Fade", "Render"
+};
+
+/* run -- run a test once */
+static void run(int test)
+{
+    int i;
+
+    switch (test) {
+    case T_OLD:
+        for (i = 0; i < NPIX; i++)
+            frame[i] = hue(2*i);
+        break;
+    case T_RAINBOW:
+        pix_rainbow(frame, NPIX, 0, 6, 255, 255);
+        break;
+    case T_GRADIENT:
+        pix_gradient(frame, NPIX, rgb(255, 0, 0), rgb(0, 0, 255));
+        break;
+    case T_ROTATE:
+        pix_rotate(frame, NPIX, 1);
+        break;
+    case T_FADE:
+        pix_fade(frame, NPIX, 200);
+        break;
+    case T_RENDER:
+        pix_render(out, frame, NPIX);
+        break;
+    }
+}
+
+/* bench_task -- time each test */
+void bench_task(int dummy)
+{
+    unsigned t0, t, best;
+    int test, k;
+
+    /* Enable the cycle counter */
+    SET_BIT(DEBUG.DEMCR, DEBUG_DEMCR_TRCENA);
+    SET_BIT(DWT.CTRL, DWT_CTRL_CYCCNTENA);
+
+    printf("\nPixel pipeline, %d pixels\n", NPIX);
+    printf("%-10s %8s %8s\n", "Stage", "Cycles", "Per pix");
+
+    for (test = 0; test < NTESTS; test++) {
+        best = 0xffffffff;
+        for (k = 0; k < NREP; k++) {
+            intr_disable();
+            t0 = DWT.CYCCNT;
+            run(test);
+            t = DWT.CYCCNT - t0;
+            intr_enable();
+            if (t < best) best = t;
+        }
+
+        printf("%-10s %8u %5u.%u\n", name[test], best,
+               best/NPIX, (10*best/NPIX) % 10);
+    }
+}
+
+void init(void)
+{
+    serial_init();
+    start("Bench", bench_task, 0, STACK);
+}
@@ -0,0 +1,76 @@
+/* x40-pixels/rainbow.c */
+/* Copyright (c) 2021 J. M. Spivey */
+
+#include "microbian.h"
+#include "hardware.h"
+#include "lib.h"
+#include "pixel.h"
+
+/* A rainbow that turns round a string of Neopixels and breathes in
+and out, with buttons A and B to change the brightness.  Each frame is
+rendered into one buffer while the driver is still sending the other,
+so drawing and sending overlap.  At each timer pulse, the frame that is
+ready is started: neopixel_start returns only when any earlier frame
+has been sent, so the buffer of that frame is then free to draw in. */
+
+#define NPIX 60                 /* Number of pixels in string */
+#define NEO PAD0                /* Pin for output signal */
+#define STEP (PIX_HUES/NPIX)    /* Hue step between pixels */
+#define TICK 20                 /* Time between frames (ms) */
+
+static unsigned frame[NPIX];    /* Logical colours */
+static unsigned out[2][NPIX];   /* Corrected frames for sending */
+
+static int bright = 128;        /* Global brightness */
+
+/* draw -- make frame t of the animation */
+static void draw(unsigned *buf, int t)
+{
+    /* The rainbow is computed once; after that it is only rotated */
+    int f = t % 128;
+
+    pix_rotate(frame, NPIX, 1);
+    pix_render(buf, frame, NPIX);
+
+    /* Breathe: fade between full and half brightness */
+    pix_fade(buf, NPIX, 128 + (f < 64 ? 2*f : 255 - 2*f));
+}
+
+/* neo_task -- drive the animation */
+void neo_task(int dummy)
+{
+    int t = 0, back = 0;
+
+    gpio_connect(BUTTON_A);
+    gpio_connect(BUTTON_B);
+    pix_brightness(bright);
+
+    pix_rainbow(frame, NPIX, 0, STEP, 255, 255);
+    draw(out[back], t++);
+    timer_pulse(TICK);
+
+    while (1) {
+        receive(PING, NULL);
+
+        /* Send the frame that is ready and draw the next one */
+        neopixel_start(NEO, out[back], NPIX);
+        back = 1 - back;
+
+        if (gpio_in(BUTTON_A) == 0 && bright > 8) {
+            bright -= 8;
+            pix_brightness(bright);
+        } else if (gpio_in(BUTTON_B) == 0 && bright < 248) {
+            bright += 8;
+            pix_brightness(bright);
+        }
+
+        draw(out[back], t++);
+    }
+}
+
+void init(void)
+{
+    timer_init();
+    neopixel_init();
+    start("Neo", neo_task, 0, STACK);
+}